@@ -1,3 +1,8 @@
 #! /bin/sh
 
-g++ -std=c++17 -DVK_DEBUG -Wall -Wextra src/*.cpp -o bin/VKEngineDEBUG.x86_64 -lSDL2 -lvulkan
\ No newline at end of file
+# io_uring is used by the asset streamer when liburing is installed
+URING=$(pkg-config --exists liburing && echo "-DVK_IO_URING -luring")
+# GLSL is compiled in process when shaderc is installed, otherwise glslangValidator is run
+SHADERC=$(pkg-config --exists shaderc && echo "-DVK_SHADERC $(pkg-config --libs shaderc)")
+
+g++ -std=c++17 -DVK_DEBUG -Wall -Wextra src/*.cpp -o bin/VKEngineDEBUG.x86_64 -pthread -lSDL2 -lvulkan $URING $SHADERC
\ No newline at end of file
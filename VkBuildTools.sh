@@ -0,0 +1,5 @@
+#! /bin/sh
+
+g++ -std=c++17 -O2 -Wall -Wextra tools/mesh_convert.cpp -o bin/mesh_convert
+g++ -std=c++17 -O2 -Wall -Wextra tools/shader_pack.cpp -o bin/shader_pack
+g++ -std=c++17 -O2 -Wall -Wextra tools/dispatch_benchmark.cpp -o bin/dispatch_benchmark -lvulkan
@@ -0,0 +1,19 @@
+#! /bin/sh
+# Packs every shader into bin/shaders.pak, which the engine maps at startup instead of opening each file.
+# GLSL sources are compiled and packed under their own path, so pipelines made from them load from the archive too.
+# Needs bin/shader_pack (VkBuildTools.sh) and glslangValidator.
+
+set -e
+COMPILED=$(mktemp -d)
+trap 'rm -rf "$COMPILED"' EXIT
+
+SHADERS=""
+for SPIRV in shaders/*.spv; do
+	SHADERS="$SHADERS $SPIRV"
+done
+for SOURCE in uncompiled_shaders/*; do
+	glslangValidator -V "$SOURCE" -o "$COMPILED/$(basename "$SOURCE").spv" > /dev/null
+	SHADERS="$SHADERS $SOURCE=$COMPILED/$(basename "$SOURCE").spv"
+done
+
+bin/shader_pack bin/shaders.pak $SHADERS
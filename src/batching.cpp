@@ -0,0 +1,176 @@
+#include "batching.h"
+#include "frame_graph.h"
+
+StaticBatcher::StaticBatcher(VkRenderer * renderer) : renderer(renderer)
+{
+}
+
+StaticBatcher::~StaticBatcher()
+{
+	for (auto & batch : batches){
+		delete batch.second.buffer;
+	}
+}
+
+BatchMember StaticBatcher::Add(string pipeline, const vector<Vertex> & vertices, const vector<uint32_t> & indices, glm::mat3 transform)
+{
+	Batch & batch = batches[pipeline];
+	Member member;
+	member.vertices = vertices;
+	member.indices = indices;
+	member.transform = transform;
+	// meshes without indices are drawn as plain triangle lists, so they get sequential ones
+	if (member.indices.empty()){
+		for (uint32_t i = 0; i < vertices.size(); i++){
+			member.indices.push_back(i);
+		}
+	}
+	batch.members.push_back(member);
+	batch.layout_dirty = true;
+	return BatchMember{pipeline, uint32_t(batch.members.size() - 1)};
+}
+
+BatchMember StaticBatcher::Add(string pipeline, const MeshFile & mesh, glm::mat3 transform)
+{
+	// The vertex stream is read as Vertex structs, a file written with another layout would be garbage
+	if (mesh.header.vertex_stride != sizeof(Vertex)){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Can't batch a mesh whose vertex layout doesn't match the renderer's Vertex struct");
+		throw runtime_error("mesh vertex stride mismatch");
+	}
+	const Vertex * vertices = static_cast<const Vertex *>(mesh.Vertices());
+	vector<uint32_t> indices(mesh.header.index_count);
+	for (uint32_t i = 0; i < mesh.header.index_count; i++){
+		indices[i] = (mesh.header.index_type == MESH_INDEX_UINT32) ?
+			static_cast<const uint32_t *>(mesh.Indices())[i] :
+			static_cast<const uint16_t *>(mesh.Indices())[i];
+	}
+	return Add(pipeline, vector<Vertex>(vertices, vertices + mesh.header.vertex_count), indices, transform);
+}
+
+void StaticBatcher::SetTransform(BatchMember member, glm::mat3 transform)
+{
+	Batch & batch = batches[member.pipeline];
+	batch.members[member.id].transform = transform;
+	batch.members[member.id].dirty = true;
+	batch.dirty = true;
+}
+
+void StaticBatcher::SetVertices(BatchMember member, const vector<Vertex> & vertices)
+{
+	Batch & batch = batches[member.pipeline];
+	Member & changed = batch.members[member.id];
+	if (vertices.size() != changed.vertices.size()){
+		batch.layout_dirty = true;
+	}
+	changed.vertices = vertices;
+	changed.dirty = true;
+	batch.dirty = true;
+}
+
+void StaticBatcher::Remove(BatchMember member)
+{
+	Batch & batch = batches[member.pipeline];
+	batch.members[member.id].alive = false;
+	batch.members[member.id].vertices.clear();
+	batch.members[member.id].indices.clear();
+	batch.layout_dirty = true;
+}
+
+void StaticBatcher::TransformVertices(const Member & member, vector<Vertex> & out)
+{
+	for (auto vertex : member.vertices){
+		vertex.pos = glm::vec2(member.transform * glm::vec3(vertex.pos, 1.0f));
+		out.push_back(vertex);
+	}
+}
+
+void StaticBatcher::Merge(Batch & batch, BufferUpload & upload)
+{
+	vector<Vertex> vertices;
+	vector<uint32_t> indices;
+	for (auto & member : batch.members){
+		if (!member.alive){ continue; }
+		member.first_vertex = vertices.size();
+		for (auto index : member.indices){
+			indices.push_back(member.first_vertex + index);
+		}
+		TransformVertices(member, vertices);
+		member.dirty = false;
+	}
+
+	// The old buffer may still be in use by frames in flight, the new one is filled before this frame draws it
+	VertexBuffer * old_buffer = batch.buffer;
+	renderer->Retire([old_buffer]{ delete old_buffer; });
+	batch.buffer = vertices.empty() ? nullptr : new VertexBuffer(vertices, indices, renderer, &upload);
+}
+
+void StaticBatcher::Rebuild(vk::CommandBuffer command_buffer)
+{
+	bool dirty = any_of(batches.begin(), batches.end(), [](const pair<const string, Batch> & entry){
+		return entry.second.layout_dirty || entry.second.dirty;
+	});
+	if (!dirty){ return; }
+
+	// Without a frame to record into (at load time) the copies get a command buffer of their own, which is waited on
+	BufferUpload upload;
+	upload.command_buffer = command_buffer;
+	if (!command_buffer){
+		upload.command_buffer = renderer->GetCommandBuffers(vk::CommandBufferLevel::ePrimary, 1)[0];
+		upload.command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit), renderer->dldid);
+	}
+	// ..in place rewrites go over vertices that earlier frames read
+	upload.command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput, vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(), nullptr, nullptr, nullptr, renderer->dldid);
+
+	for (auto & entry : batches){
+		Batch & batch = entry.second;
+		if (batch.layout_dirty){
+			Merge(batch, upload);
+		}
+		else if (batch.dirty && batch.buffer){
+			// Only members that changed get rewritten, at the same place in the merged buffer
+			for (auto & member : batch.members){
+				if (!member.alive || !member.dirty){ continue; }
+				vector<Vertex> vertices;
+				TransformVertices(member, vertices);
+				batch.buffer->Write(renderer, vertices.data(), sizeof(Vertex) * member.first_vertex, sizeof(Vertex) * vertices.size(), upload);
+				member.dirty = false;
+			}
+		}
+		batch.layout_dirty = false;
+		batch.dirty = false;
+	}
+
+	// ..and the draws after them read what they wrote
+	auto copied = vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead);
+	upload.command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput,
+		vk::DependencyFlags(), copied, nullptr, nullptr, renderer->dldid);
+
+	if (command_buffer){
+		// The staging memory goes once the frame is done with it
+		renderer->Retire([upload]() mutable { upload.Release(); }, true);
+		return;
+	}
+	upload.command_buffer.end(renderer->dldid);
+	vk::Fence copied_fence = renderer->device->createFence(vk::FenceCreateInfo()).value;
+	auto submit_info = vk::SubmitInfo(0, nullptr, nullptr, 1, &upload.command_buffer);
+	renderer->graphics_queue.submit(submit_info, copied_fence, renderer->dldid);
+	renderer->device->waitForFences(copied_fence, VK_TRUE, UINT64_MAX, renderer->dldid);
+	renderer->device->destroyFence(copied_fence);
+	renderer->device->freeCommandBuffers(renderer->command_pool, upload.command_buffer);
+	upload.Release();
+}
+
+void StaticBatcher::Draw(vk::CommandBuffer command_buffer)
+{
+	for (auto & entry : batches){
+		if (!entry.second.buffer){ continue; }
+		if (!renderer->pipeline_infos.count(entry.first)){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "No pipeline %s to draw its batch with", entry.first.c_str());
+			continue;
+		}
+		// ..the pipeline made for the pass this is drawn in
+		command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, renderer->frame_graph->GetPipeline(entry.first), renderer->dldid);
+		entry.second.buffer->Draw(command_buffer);
+	}
+}
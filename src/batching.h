@@ -0,0 +1,54 @@
+#pragma once
+#include "renderer.h"
+
+// Static Batching
+// Meshes that are drawn with the same pipeline get merged into one vertex/index buffer per pipeline,
+// with their transforms baked into the vertices, so each batch is a single bind and a single draw.
+// Rebuild() applies changes: a member that only moved (or changed its vertices but not their count) is
+// rewritten in place, anything that changes the layout of the batch (adding, removing, resizing) re-merges it.
+// Rebuilds given the frame's command buffer record their copies into it, ahead of the draws, so nothing waits for the GPU.
+// Re-merging still builds the whole batch on the CPU, so it's meant for occasional changes, not every frame.
+struct BatchMember {
+	string pipeline;
+	uint32_t id;
+};
+
+class StaticBatcher {
+	public:
+		StaticBatcher(VkRenderer * renderer);
+		~StaticBatcher();
+
+		BatchMember Add(string pipeline, const vector<Vertex> & vertices, const vector<uint32_t> & indices = {}, glm::mat3 transform = glm::mat3());
+		BatchMember Add(string pipeline, const MeshFile & mesh, glm::mat3 transform = glm::mat3());
+		void SetTransform(BatchMember member, glm::mat3 transform);
+		void SetVertices(BatchMember member, const vector<Vertex> & vertices);
+		void Remove(BatchMember member);
+
+		// ..Brings the GPU buffers up to date with every change since the last call. Given a command buffer (a frame's, after
+		// ..BeginScene) the copies are recorded into it, otherwise they're submitted and waited on (at load time)
+		void Rebuild(vk::CommandBuffer command_buffer = nullptr);
+		// ..One pipeline bind and one draw per batch, from inside a frame graph pass (pipelines are made for its target)
+		void Draw(vk::CommandBuffer command_buffer);
+
+	private:
+		struct Member {
+			vector<Vertex> vertices;
+			vector<uint32_t> indices;
+			glm::mat3 transform;
+			uint32_t first_vertex = 0;
+			bool alive = true;
+			bool dirty = true;
+		};
+		struct Batch {
+			vector<Member> members;
+			VertexBuffer * buffer = nullptr;
+			bool layout_dirty = true;
+			bool dirty = true;
+		};
+
+		VkRenderer * renderer;
+		map<string, Batch> batches;
+
+		static void TransformVertices(const Member & member, vector<Vertex> & out);
+		void Merge(Batch & batch, BufferUpload & upload);
+};
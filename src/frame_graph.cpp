@@ -0,0 +1,931 @@
+#include "frame_graph.h"
+
+#include <stdexcept>
+
+// How each usage touches a resource
+struct UsageInfo {
+	vk::PipelineStageFlags stages;
+	vk::AccessFlags access;
+	vk::ImageLayout layout;
+	vk::ImageUsageFlags image_usage;
+	vk::BufferUsageFlags buffer_usage;
+};
+
+static UsageInfo Info(FrameGraphUsage usage)
+{
+	typedef vk::PipelineStageFlagBits Stage;
+	typedef vk::AccessFlagBits Access;
+	typedef vk::ImageLayout Layout;
+	switch (usage){
+		case FrameGraphUsage::ColorAttachment:
+			return {Stage::eColorAttachmentOutput, Access::eColorAttachmentRead | Access::eColorAttachmentWrite,
+					Layout::eColorAttachmentOptimal, vk::ImageUsageFlagBits::eColorAttachment, vk::BufferUsageFlags()};
+		case FrameGraphUsage::DepthAttachment:
+			return {Stage::eEarlyFragmentTests | Stage::eLateFragmentTests, Access::eDepthStencilAttachmentRead | Access::eDepthStencilAttachmentWrite,
+					Layout::eDepthStencilAttachmentOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment, vk::BufferUsageFlags()};
+		case FrameGraphUsage::InputAttachment:
+			return {Stage::eFragmentShader, Access::eInputAttachmentRead,
+					Layout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eInputAttachment, vk::BufferUsageFlags()};
+		case FrameGraphUsage::ResolveAttachment:
+			return {Stage::eColorAttachmentOutput, Access::eColorAttachmentWrite,
+					Layout::eColorAttachmentOptimal, vk::ImageUsageFlagBits::eColorAttachment, vk::BufferUsageFlags()};
+		case FrameGraphUsage::SampledFragment:
+			return {Stage::eFragmentShader, Access::eShaderRead,
+					Layout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled, vk::BufferUsageFlags()};
+		case FrameGraphUsage::SampledCompute:
+			return {Stage::eComputeShader, Access::eShaderRead,
+					Layout::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled, vk::BufferUsageFlags()};
+		case FrameGraphUsage::StorageRead:
+			return {Stage::eComputeShader, Access::eShaderRead,
+					Layout::eGeneral, vk::ImageUsageFlagBits::eStorage, vk::BufferUsageFlagBits::eStorageBuffer};
+		case FrameGraphUsage::StorageWrite:
+			return {Stage::eComputeShader, Access::eShaderWrite,
+					Layout::eGeneral, vk::ImageUsageFlagBits::eStorage, vk::BufferUsageFlagBits::eStorageBuffer};
+		case FrameGraphUsage::TransferSrc:
+			return {Stage::eTransfer, Access::eTransferRead,
+					Layout::eTransferSrcOptimal, vk::ImageUsageFlagBits::eTransferSrc, vk::BufferUsageFlagBits::eTransferSrc};
+		case FrameGraphUsage::TransferDst:
+			return {Stage::eTransfer, Access::eTransferWrite,
+					Layout::eTransferDstOptimal, vk::ImageUsageFlagBits::eTransferDst, vk::BufferUsageFlagBits::eTransferDst};
+		case FrameGraphUsage::UniformRead:
+			return {Stage::eVertexShader | Stage::eFragmentShader | Stage::eComputeShader, Access::eUniformRead,
+					Layout::eUndefined, vk::ImageUsageFlags(), vk::BufferUsageFlagBits::eUniformBuffer};
+	}
+	return {};
+}
+
+static bool IsAttachment(FrameGraphUsage usage)
+{
+	return usage == FrameGraphUsage::ColorAttachment || usage == FrameGraphUsage::DepthAttachment ||
+		   usage == FrameGraphUsage::InputAttachment || usage == FrameGraphUsage::ResolveAttachment;
+}
+
+static vk::ImageAspectFlags AspectOf(vk::Format format)
+{
+	switch (format){
+		case vk::Format::eD16Unorm:
+		case vk::Format::eX8D24UnormPack32:
+		case vk::Format::eD32Sfloat:
+			return vk::ImageAspectFlagBits::eDepth;
+		case vk::Format::eD16UnormS8Uint:
+		case vk::Format::eD24UnormS8Uint:
+		case vk::Format::eD32SfloatS8Uint:
+			return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+		case vk::Format::eS8Uint:
+			return vk::ImageAspectFlagBits::eStencil;
+		default:
+			return vk::ImageAspectFlagBits::eColor;
+	}
+}
+
+// Bytes per texel, for the traffic estimate (formats it doesn't know count as 4)
+static uint64_t TexelSize(vk::Format format)
+{
+	switch (format){
+		case vk::Format::eR8Unorm:
+		case vk::Format::eS8Uint:
+			return 1;
+		case vk::Format::eR8G8Unorm:
+		case vk::Format::eR16Sfloat:
+		case vk::Format::eD16Unorm:
+			return 2;
+		case vk::Format::eD16UnormS8Uint:
+			return 3;
+		case vk::Format::eD32SfloatS8Uint:
+			return 5;
+		case vk::Format::eR16G16B16A16Sfloat:
+		case vk::Format::eR32G32Sfloat:
+			return 8;
+		case vk::Format::eR32G32B32A32Sfloat:
+			return 16;
+		default:
+			return 4;
+	}
+}
+
+//_______________________________ DECLARING A FRAME _____________________________________________
+
+void FrameGraph::PassBuilder::Read(string resource, FrameGraphUsage usage)
+{
+	Access(resource, usage, false, false, vk::ClearValue(), AttachmentPolicy());
+}
+
+void FrameGraph::PassBuilder::Write(string resource, FrameGraphUsage usage, AttachmentPolicy policy)
+{
+	Access(resource, usage, true, false, vk::ClearValue(), policy);
+}
+
+void FrameGraph::PassBuilder::Write(string resource, FrameGraphUsage usage, vk::ClearValue clear, AttachmentPolicy policy)
+{
+	Access(resource, usage, true, true, clear, policy);
+}
+
+void FrameGraph::PassBuilder::Access(string resource, FrameGraphUsage usage, bool write, bool clear, vk::ClearValue clear_value, AttachmentPolicy policy)
+{
+	graph->passes[pass].accesses.push_back({graph->Find(resource), usage, write, clear, clear_value, policy});
+}
+
+FrameGraph::FrameGraph(VkRenderer * renderer) : renderer(renderer) {}
+
+FrameGraph::~FrameGraph()
+{
+	ReleaseTransients();
+}
+
+void FrameGraph::Reset()
+{
+	resources.clear();
+	resource_names.clear();
+	passes.clear();
+	order.clear();
+}
+
+size_t FrameGraph::Find(string name)
+{
+	auto found = resource_names.find(name);
+	if (found == resource_names.end()){
+		throw logic_error("frame graph has no resource named " + name);
+	}
+	return found->second;
+}
+
+size_t FrameGraph::AddResource(string name)
+{
+	if (resource_names.count(name)){
+		throw logic_error("frame graph resource " + name + " declared twice");
+	}
+	resource_names[name] = resources.size();
+	resources.push_back(Resource());
+	resources.back().name = name;
+	return resources.size() - 1;
+}
+
+void FrameGraph::CreateImage(string name, vk::Format format, vk::Extent2D extent, vk::Rect2D area, vk::SampleCountFlagBits samples)
+{
+	Resource & resource = resources[AddResource(name)];
+	resource.format = format;
+	resource.extent = extent;
+	resource.area = area.extent.width ? area : vk::Rect2D(vk::Offset2D(), extent);
+	resource.samples = samples;
+}
+
+void FrameGraph::CreateBuffer(string name, vk::DeviceSize size)
+{
+	Resource & resource = resources[AddResource(name)];
+	resource.image = false;
+	resource.size = size;
+}
+
+void FrameGraph::ImportImage(string name, const ImportedImage & image)
+{
+	Resource & resource = resources[AddResource(name)];
+	resource.imported = true;
+	resource.import = image;
+	resource.format = image.format;
+	resource.extent = image.extent;
+	resource.area = image.area.extent.width ? image.area : vk::Rect2D(vk::Offset2D(), image.extent);
+	resource.vk_image = image.image;
+	resource.view = image.view;
+}
+
+void FrameGraph::ImportBuffer(string name, vk::Buffer buffer, vk::DeviceSize size)
+{
+	Resource & resource = resources[AddResource(name)];
+	resource.image = false;
+	resource.imported = true;
+	resource.buffer = buffer;
+	resource.size = size;
+}
+
+void FrameGraph::AddPass(string name, function<void(PassBuilder &)> setup, function<void(vk::CommandBuffer)> execute,
+						 function<void(vk::CommandBuffer)> before_barriers)
+{
+	passes.push_back({name, {}, execute, false, before_barriers});
+	PassBuilder builder;
+	builder.graph = this;
+	builder.pass = passes.size() - 1;
+	setup(builder);
+}
+
+vk::Image FrameGraph::GetImage(string name){ return resources[Find(name)].vk_image; }
+vk::ImageView FrameGraph::GetImageView(string name){ return resources[Find(name)].view; }
+vk::Buffer FrameGraph::GetBuffer(string name){ return resources[Find(name)].buffer; }
+vk::Rect2D FrameGraph::GetArea(string name){ return resources[Find(name)].area; }
+vk::Extent2D FrameGraph::GetExtent(string name){ return resources[Find(name)].extent; }
+
+vk::Pipeline FrameGraph::GetPipeline(string name)
+{
+	if (current_render_pass){
+		return renderer->GetPassPipeline(name, current_render_pass, current_subpass);
+	}
+	return renderer->GetRenderingPipeline(name, current_color_formats, current_depth_format);
+}
+
+//_______________________________ COMPILING _____________________________________________
+
+void FrameGraph::Compile()
+{
+	// A pass depends on the last pass before it to write what it reads, and a writer also on the readers before it.
+	// Passes only see what was added before them, so the order they were added in is always a valid one.
+	vector<set<size_t>> dependencies(passes.size());
+	vector<int> last_writer(resources.size(), -1);
+	vector<vector<size_t>> readers(resources.size());
+	for (size_t p = 0; p < passes.size(); p++){
+		for (auto & access : passes[p].accesses){
+			int writer = last_writer[access.resource];
+			if (writer >= 0 && size_t(writer) != p){ dependencies[p].insert(size_t(writer)); }
+			if (access.write){
+				for (auto reader : readers[access.resource]){
+					if (reader != p){ dependencies[p].insert(reader); }
+				}
+				readers[access.resource].clear();
+				last_writer[access.resource] = int(p);
+			}
+			else {
+				readers[access.resource].push_back(p);
+			}
+		}
+	}
+
+	// Culling: passes writing imported resources are the frame's results, everything else has to feed into one of them
+	for (auto & pass : passes){
+		pass.kept = false;
+		for (auto & access : pass.accesses){
+			pass.kept = pass.kept || (access.write && resources[access.resource].imported);
+		}
+	}
+	for (size_t p = passes.size(); p-- > 0;){
+		if (!passes[p].kept){ continue; }
+		for (auto dependency : dependencies[p]){
+			passes[dependency].kept = true;
+		}
+	}
+	order.clear();
+	for (size_t p = 0; p < passes.size(); p++){
+		if (passes[p].kept){ order.push_back(p); }
+	}
+
+	// ..passes chained through input attachments share a render pass, as its subpasses
+	groups.clear();
+	group_of.clear();
+	for (size_t i = 0; i < order.size();){
+		vector<size_t> group = {order[i++]};
+		while (i < order.size() && JoinsSubpasses(group, order[i])){
+			group.push_back(order[i++]);
+		}
+		groups.push_back(group);
+		group_of.resize(i, int(groups.size()) - 1);
+	}
+
+	// Lifetimes and usage of what the kept passes touch
+	for (auto & resource : resources){
+		resource.first_pass = resource.last_pass = -1;
+		resource.image_usage = vk::ImageUsageFlags();
+		resource.buffer_usage = vk::BufferUsageFlags();
+	}
+	for (size_t i = 0; i < order.size(); i++){
+		for (auto & access : passes[order[i]].accesses){
+			Resource & resource = resources[access.resource];
+			if (resource.first_pass < 0){ resource.first_pass = int(i); }
+			resource.last_pass = int(i);
+			UsageInfo info = Info(access.usage);
+			resource.image_usage |= info.image_usage;
+			resource.buffer_usage |= info.buffer_usage;
+		}
+	}
+
+	// The transients are only made again when they change
+	string key;
+	for (auto & resource : resources){
+		if (resource.imported || resource.first_pass < 0){ continue; }
+		key += resource.name + ":" + to_string(resource.image) + ":" + to_string(uint32_t(resource.format)) + ":" +
+			   to_string(resource.extent.width) + "x" + to_string(resource.extent.height) + ":" + to_string(uint32_t(resource.samples)) + ":" +
+			   to_string(resource.size) + ":" + to_string(uint32_t(resource.image_usage)) + ":" + to_string(uint32_t(resource.buffer_usage)) + ":" +
+			   to_string(resource.first_pass) + "-" + to_string(resource.last_pass) + ":" +
+			   to_string(group_of[resource.first_pass]) + "-" + to_string(group_of[resource.last_pass]) + ";";
+	}
+	if (key != transient_key){
+		ReleaseTransients();
+		transient_key = key;
+		AllocateTransients();
+	}
+	for (auto & resource : resources){
+		if (resource.imported || resource.first_pass < 0){ continue; }
+		Transient & transient = transients[resource.name];
+		resource.vk_image = transient.image;
+		resource.view = transient.view;
+		resource.buffer = transient.buffer;
+	}
+}
+
+void FrameGraph::AllocateTransients()
+{
+	vk::Device device = renderer->device.get();
+	vk::DeviceSize granularity = renderer->gpu_properties.limits.bufferImageGranularity;
+	uint32_t lazy_types = 0;
+	for (uint32_t i = 0; i < renderer->gpu_memory_info.memoryTypeCount; i++){
+		if (renderer->gpu_memory_info.memoryTypes[i].propertyFlags & vk::MemoryPropertyFlagBits::eLazilyAllocated){ lazy_types |= 1u << i; }
+	}
+	vk::ImageUsageFlags attachment_usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment |
+										   vk::ImageUsageFlagBits::eInputAttachment;
+	int lazy_count = 0;
+
+	struct Placement {
+		string name;
+		vk::MemoryRequirements requirements;
+		int first_pass, last_pass;
+		vk::DeviceSize offset;
+	};
+	vector<Placement> placements;
+	for (auto & resource : resources){
+		if (resource.imported || resource.first_pass < 0){ continue; }
+		Transient transient;
+		transient.first_pass = resource.first_pass;
+		transient.last_pass = resource.last_pass;
+		vk::MemoryRequirements requirements;
+		if (resource.image){
+			// ..an attachment that only lives within one render pass is never loaded or stored, so it can be transient
+			bool transient_attachment = group_of[resource.first_pass] == group_of[resource.last_pass] && !(resource.image_usage & ~attachment_usage);
+			transient.image = device.createImage(vk::ImageCreateInfo(
+				vk::ImageCreateFlags(), vk::ImageType::e2D, resource.format,
+				vk::Extent3D(resource.extent, 1), 1, 1, resource.samples, vk::ImageTiling::eOptimal,
+				transient_attachment ? resource.image_usage | vk::ImageUsageFlagBits::eTransientAttachment : resource.image_usage,
+				vk::SharingMode::eExclusive, 0, nullptr, vk::ImageLayout::eUndefined)).value;
+			requirements = device.getImageMemoryRequirements(transient.image);
+
+			if (transient_attachment && (requirements.memoryTypeBits & lazy_types)){
+				requirements.memoryTypeBits &= lazy_types;
+				transient.allocation = renderer->gpu_allocator.allocateMemory(requirements,
+					vma::AllocationCreateInfo(vma::AllocationCreateFlags(), vma::MemoryUsage::eGpuLazilyAllocated)).value;
+				renderer->gpu_allocator.bindImageMemory2(transient.allocation, 0, transient.image, nullptr);
+				transient.size = requirements.size;
+				transients[resource.name] = transient;
+				lazy_count++;
+				continue;
+			}
+		}
+		else {
+			transient.buffer = device.createBuffer(vk::BufferCreateInfo(
+				vk::BufferCreateFlags(), resource.size, resource.buffer_usage, vk::SharingMode::eExclusive)).value;
+			requirements = device.getBufferMemoryRequirements(transient.buffer);
+		}
+		// ..buffers and images sitting next to each other have to be bufferImageGranularity apart
+		requirements.alignment = max(requirements.alignment, granularity);
+		transient.size = requirements.size;
+		transients[resource.name] = transient;
+		placements.push_back({resource.name, requirements, resource.first_pass, resource.last_pass, 0});
+	}
+	if (placements.empty()){
+		CreateTransientViews();
+		return;
+	}
+
+	// Biggest first, each one goes at the lowest offset where it doesn't overlap anything alive at the same time
+	sort(placements.begin(), placements.end(), [](const Placement & a, const Placement & b){ return a.requirements.size > b.requirements.size; });
+	vk::DeviceSize heap_size = 0, heap_alignment = 1, total_size = 0;
+	uint32_t memory_types = ~0u;
+	for (size_t i = 0; i < placements.size(); i++){
+		Placement & placement = placements[i];
+		vk::DeviceSize alignment = placement.requirements.alignment;
+		bool moved = true;
+		while (moved){
+			moved = false;
+			for (size_t j = 0; j < i; j++){
+				Placement & other = placements[j];
+				// ..by render pass, a barrier can't go between two subpasses' uses of the same memory
+				bool alive_together = group_of[placement.first_pass] <= group_of[other.last_pass] && group_of[other.first_pass] <= group_of[placement.last_pass];
+				bool overlapping = placement.offset < other.offset + other.requirements.size && other.offset < placement.offset + placement.requirements.size;
+				if (alive_together && overlapping){
+					placement.offset = (other.offset + other.requirements.size + alignment - 1) / alignment * alignment;
+					moved = true;
+				}
+			}
+		}
+		heap_size = max(heap_size, placement.offset + placement.requirements.size);
+		heap_alignment = max(heap_alignment, alignment);
+		total_size += placement.requirements.size;
+		memory_types &= placement.requirements.memoryTypeBits;
+	}
+
+	// One heap when a memory type suits all of them, otherwise nothing shares memory
+	if (memory_types){
+		heap = renderer->gpu_allocator.allocateMemory(vk::MemoryRequirements(heap_size, heap_alignment, memory_types),
+			vma::AllocationCreateInfo(vma::AllocationCreateFlags(), vma::MemoryUsage::eGpuOnly)).value;
+	}
+	for (auto & placement : placements){
+		Transient & transient = transients[placement.name];
+		transient.offset = placement.offset;
+		if (!heap){
+			transient.allocation = renderer->gpu_allocator.allocateMemory(placement.requirements,
+				vma::AllocationCreateInfo(vma::AllocationCreateFlags(), vma::MemoryUsage::eGpuOnly)).value;
+			transient.offset = 0;
+		}
+		vma::Allocation memory = heap ? heap : transient.allocation;
+		if (transient.image){
+			renderer->gpu_allocator.bindImageMemory2(memory, transient.offset, transient.image, nullptr);
+		}
+		else {
+			renderer->gpu_allocator.bindBufferMemory2(memory, transient.offset, transient.buffer, nullptr);
+		}
+	}
+
+	CreateTransientViews();
+
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Frame graph: %d transient resources, %llu KB in %s (%llu KB without aliasing), and %d lazily allocated",
+		int(placements.size()), (unsigned long long)((heap ? heap_size : total_size) >> 10), heap ? "one heap" : "separate allocations",
+		(unsigned long long)(total_size >> 10), lazy_count);
+}
+
+void FrameGraph::CreateTransientViews()
+{
+	for (auto & resource : resources){
+		if (resource.imported || resource.first_pass < 0 || !resource.image){ continue; }
+		Transient & transient = transients[resource.name];
+		transient.view = renderer->device->createImageView(vk::ImageViewCreateInfo(
+			vk::ImageViewCreateFlags(), transient.image, vk::ImageViewType::e2D, resource.format,
+			vk::ComponentMapping(), vk::ImageSubresourceRange(AspectOf(resource.format), 0, 1, 0, 1))).value;
+	}
+}
+
+void FrameGraph::ReleaseTransients()
+{
+	// Frames in flight may still be using them
+	for (auto & entry : transients){
+		Transient transient = entry.second;
+		if (transient.view){
+			renderer->EvictFramebuffers({transient.view});
+		}
+		VkRenderer * owner = renderer;
+		renderer->Retire([owner, transient]{
+			if (transient.view){ owner->device->destroyImageView(transient.view); }
+			if (transient.image){ owner->device->destroyImage(transient.image); }
+			if (transient.buffer){ owner->device->destroyBuffer(transient.buffer); }
+			if (transient.allocation){ owner->gpu_allocator.freeMemory(transient.allocation); }
+		});
+	}
+	if (heap){
+		VkRenderer * owner = renderer;
+		vma::Allocation retired_heap = heap;
+		renderer->Retire([owner, retired_heap]{ owner->gpu_allocator.freeMemory(retired_heap); });
+	}
+	transients.clear();
+	transient_key.clear();
+	heap = nullptr;
+}
+
+//_______________________________ RECORDING _____________________________________________
+
+void FrameGraph::Execute(vk::CommandBuffer command_buffer)
+{
+	Compile();
+	traffic = AttachmentTraffic();
+
+	// Starting states: imported resources say what they come from. A transient's memory may have been used by any
+	// transient it overlaps with (itself included) in the frame before, so its first use waits for all of those.
+	// (the ones it overlaps with earlier in this frame are added as its first pass is reached, below)
+	for (auto & resource : resources){
+		resource.read_stages = resource.visible_stages = vk::PipelineStageFlags();
+		resource.visible_access = vk::AccessFlags();
+		if (resource.imported){
+			resource.layout = resource.import.initial_layout;
+			resource.write_stages = resource.import.initial_stages;
+			resource.write_access = resource.import.initial_access;
+			resource.has_contents = !resource.image || resource.import.initial_layout != vk::ImageLayout::eUndefined;
+			continue;
+		}
+		resource.layout = vk::ImageLayout::eUndefined;
+		resource.write_stages = vk::PipelineStageFlags();
+		resource.write_access = vk::AccessFlags();
+		resource.has_contents = false;
+		if (resource.first_pass < 0){ continue; }
+		Transient & transient = transients[resource.name];
+		for (auto & entry : transients){
+			if (Aliases(transient, entry.second)){
+				resource.write_stages |= entry.second.last_stages;
+				resource.write_access |= entry.second.last_writes;
+			}
+		}
+	}
+
+	int position = 0;
+	for (auto & group : groups){
+		// A transient starting here takes over memory from the ones that finished before it, it waits for their uses too
+		for (auto & resource : resources){
+			if (resource.imported || resource.first_pass < position || resource.first_pass >= position + int(group.size())){ continue; }
+			for (auto & other : resources){
+				if (other.imported || other.first_pass < 0 || other.last_pass >= resource.first_pass ||
+					!Aliases(transients[resource.name], transients[other.name])){ continue; }
+				resource.write_stages |= other.write_stages | other.read_stages;
+				resource.write_access |= other.write_access;
+			}
+		}
+		position += int(group.size());
+		RecordPasses(command_buffer, group, position - 1);
+	}
+
+	// Imported images are left how their owner wants them (presentable, for example)
+	vector<vk::ImageMemoryBarrier> final_barriers;
+	vk::PipelineStageFlags src_stages;
+	for (auto & resource : resources){
+		if (!resource.imported || !resource.image || resource.import.final_layout == vk::ImageLayout::eUndefined ||
+			resource.import.final_layout == resource.layout){ continue; }
+		vk::PipelineStageFlags stages = resource.write_stages | resource.read_stages;
+		src_stages |= stages ? stages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe);
+		final_barriers.push_back(vk::ImageMemoryBarrier(
+			resource.write_access, vk::AccessFlags(), resource.layout, resource.import.final_layout,
+			VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, resource.vk_image,
+			vk::ImageSubresourceRange(AspectOf(resource.format), 0, 1, 0, 1)));
+		resource.layout = resource.import.final_layout;
+	}
+	if (!final_barriers.empty()){
+		command_buffer.pipelineBarrier(src_stages, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(),
+			nullptr, nullptr, final_barriers, renderer->dldid);
+	}
+
+	for (auto & resource : resources){
+		if (resource.imported || resource.first_pass < 0){ continue; }
+		Transient & transient = transients[resource.name];
+		transient.last_stages = resource.write_stages | resource.read_stages;
+		transient.last_writes = resource.write_access;
+	}
+}
+
+bool FrameGraph::Aliases(const Transient & a, const Transient & b) const
+{
+	return &a == &b || (heap && !a.allocation && !b.allocation && a.offset < b.offset + b.size && b.offset < a.offset + a.size);
+}
+
+void FrameGraph::Barrier(Resource & resource, FrameGraphUsage usage, bool write, bool discard, vector<vk::ImageMemoryBarrier> & image_barriers,
+						 vector<vk::BufferMemoryBarrier> & buffer_barriers, vk::PipelineStageFlags & src_stages, vk::PipelineStageFlags & dst_stages)
+{
+	UsageInfo info = Info(usage);
+	bool layout_change = resource.image && resource.layout != info.layout;
+
+	// Writes and layout changes wait for everything before them, reads only for the last write (unless it's already visible to them)
+	vk::PipelineStageFlags src;
+	vk::AccessFlags src_access;
+	bool needed = false;
+	if (layout_change || write){
+		src = resource.write_stages | resource.read_stages;
+		src_access = resource.write_access;
+		needed = layout_change || bool(src);
+	}
+	else if (resource.write_stages && !((resource.visible_stages & info.stages) == info.stages && (resource.visible_access & info.access) == info.access)){
+		src = resource.write_stages;
+		src_access = resource.write_access;
+		needed = true;
+	}
+
+	if (needed){
+		src_stages |= src ? src : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe);
+		dst_stages |= info.stages;
+		if (resource.image){
+			// ..from an undefined layout when the old contents can go, which spares the driver keeping them
+			image_barriers.push_back(vk::ImageMemoryBarrier(
+				src_access, info.access, (discard && layout_change) ? vk::ImageLayout::eUndefined : resource.layout, info.layout,
+				VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, resource.vk_image,
+				vk::ImageSubresourceRange(AspectOf(resource.format), 0, 1, 0, 1)));
+		}
+		else {
+			buffer_barriers.push_back(vk::BufferMemoryBarrier(
+				src_access, info.access, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, resource.buffer, 0, VK_WHOLE_SIZE));
+		}
+	}
+
+	if (write || layout_change){
+		// ..a layout change counts as a write, later readers have to come after it
+		resource.write_stages = info.stages;
+		resource.write_access = write ? info.access : vk::AccessFlags();
+		resource.read_stages = write ? vk::PipelineStageFlags() : info.stages;
+		resource.visible_stages = write ? vk::PipelineStageFlags() : info.stages;
+		resource.visible_access = write ? vk::AccessFlags() : info.access;
+	}
+	else {
+		resource.read_stages |= info.stages;
+		if (needed){
+			resource.visible_stages |= info.stages;
+			resource.visible_access |= info.access;
+		}
+	}
+	if (resource.image){
+		resource.layout = info.layout;
+	}
+}
+
+vector<FrameGraph::Access> FrameGraph::MergedAccesses(const Pass & pass)
+{
+	// A resource used more than once the same way by a pass is one access (written if any of them writes)
+	vector<Access> accesses;
+	for (auto & access : pass.accesses){
+		auto same = find_if(accesses.begin(), accesses.end(), [&](const Access & other){
+			return other.resource == access.resource && other.usage == access.usage; });
+		if (same == accesses.end()){
+			accesses.push_back(access);
+			continue;
+		}
+		same->write = same->write || access.write;
+		if (access.write){
+			same->policy.needs_previous_contents = same->policy.needs_previous_contents && access.policy.needs_previous_contents;
+			if (access.policy.consumed_by != AttachmentPolicy::Graph){ same->policy.consumed_by = access.policy.consumed_by; }
+		}
+		if (access.clear){
+			same->clear = true;
+			same->clear_value = access.clear_value;
+		}
+	}
+	return accesses;
+}
+
+bool FrameGraph::JoinsSubpasses(const vector<size_t> & group, size_t pass)
+{
+	// A pass becomes the next subpass when it only uses attachments, of the same size, and reads one the group wrote
+	// as an input attachment. Anything else needs a barrier (or a different framebuffer) between them.
+	vector<Access> first = MergedAccesses(passes[group.front()]);
+	vector<Access> accesses = MergedAccesses(passes[pass]);
+	vk::Extent2D extent;
+	for (auto & access : first){
+		if (!IsAttachment(access.usage)){ continue; }
+		extent = resources[access.resource].extent;
+		break;
+	}
+	if (!extent.width){ return false; }
+
+	bool reads_group = false;
+	for (auto & access : accesses){
+		Resource & resource = resources[access.resource];
+		if (!IsAttachment(access.usage) || resource.extent != extent){ return false; }
+		for (auto & other : accesses){
+			// ..reading an attachment while drawing into it isn't supported
+			if (other.resource == access.resource && other.usage != access.usage){ return false; }
+		}
+		if (access.usage != FrameGraphUsage::InputAttachment){ continue; }
+		for (auto p : group){
+			for (auto & earlier : passes[p].accesses){
+				reads_group = reads_group || (earlier.resource == access.resource && earlier.write);
+			}
+		}
+	}
+	return reads_group;
+}
+
+void FrameGraph::RecordPasses(vk::CommandBuffer command_buffer, const vector<size_t> & group, int last_position)
+{
+	vector<vector<Access>> subpass_accesses;
+	for (auto p : group){
+		subpass_accesses.push_back(MergedAccesses(passes[p]));
+		if (passes[p].before_barriers){ passes[p].before_barriers(command_buffer); }
+	}
+
+	// Everything the passes use is made ready with one barrier, as the first of them uses it
+	// (later uses within the render pass are ordered by subpass dependencies instead)
+	vector<size_t> used;                 // resources, in the order they're first used
+	map<size_t, size_t> attachment_of;   // resource -> attachment index
+	map<size_t, bool> had_contents, written;
+	vector<vk::ImageMemoryBarrier> image_barriers;
+	vector<vk::BufferMemoryBarrier> buffer_barriers;
+	vk::PipelineStageFlags src_stages, dst_stages;
+	for (auto & accesses : subpass_accesses){
+		for (auto & access : accesses){
+			Resource & resource = resources[access.resource];
+			if (!had_contents.count(access.resource)){
+				// ..contents that get cleared, or that the pass says it doesn't need, aren't kept
+				bool needed = !access.write || (!access.clear && access.policy.needs_previous_contents);
+				used.push_back(access.resource);
+				had_contents[access.resource] = resource.has_contents && needed;
+				Barrier(resource, access.usage, access.write, !needed, image_barriers, buffer_barriers, src_stages, dst_stages);
+			}
+			written[access.resource] = written[access.resource] || access.write;
+		}
+	}
+	if (!image_barriers.empty() || !buffer_barriers.empty()){
+		command_buffer.pipelineBarrier(src_stages, dst_stages, vk::DependencyFlags(), nullptr, buffer_barriers, image_barriers, renderer->dldid);
+	}
+
+	// ..the tracked states follow every use, as if each had its own barrier (subpass dependencies stand in for them)
+	vector<vk::ImageMemoryBarrier> unused_image_barriers;
+	vector<vk::BufferMemoryBarrier> unused_buffer_barriers;
+	vk::PipelineStageFlags unused_src, unused_dst;
+	map<size_t, bool> seen;
+	for (auto & accesses : subpass_accesses){
+		for (auto & access : accesses){
+			if (seen[access.resource]){
+				Barrier(resources[access.resource], access.usage, access.write, false, unused_image_barriers, unused_buffer_barriers, unused_src, unused_dst);
+			}
+			seen[access.resource] = true;
+		}
+	}
+	for (auto resource : used){
+		resources[resource].has_contents = resources[resource].has_contents || written[resource];
+	}
+
+	bool has_attachments = false;
+	for (auto & access : subpass_accesses.front()){
+		has_attachments = has_attachments || IsAttachment(access.usage);
+	}
+	if (!has_attachments){
+		passes[group.front()].execute(command_buffer);
+		return;
+	}
+
+	// One attachment per resource. The render pass moves it between the layouts its subpasses use, and leaves it
+	// in the last one (where the barriers pick it up from)
+	vector<vk::AttachmentDescription> attachments;
+	vector<vk::ImageView> views;
+	vector<vk::ClearValue> clear_values;
+	vk::Extent2D extent(UINT32_MAX, UINT32_MAX);
+	vk::Rect2D area;
+	bool has_area = false;
+	for (auto & accesses : subpass_accesses){
+		for (auto & access : accesses){
+			Resource & resource = resources[access.resource];
+			vk::ImageLayout layout = Info(access.usage).layout;
+			if (attachment_of.count(access.resource)){
+				attachments[attachment_of[access.resource]].finalLayout = layout;
+				continue;
+			}
+			vk::AttachmentLoadOp load = access.clear ? vk::AttachmentLoadOp::eClear :
+										had_contents[access.resource] ? vk::AttachmentLoadOp::eLoad : vk::AttachmentLoadOp::eDontCare;
+			// ..only what's imported or used after the render pass is stored, unless the passes say otherwise
+			bool needed_after = resource.imported || resource.last_pass > last_position;
+			for (auto & later : subpass_accesses){
+				for (auto & other : later){
+					if (other.resource != access.resource || other.policy.consumed_by == AttachmentPolicy::Graph){ continue; }
+					needed_after = other.policy.consumed_by == AttachmentPolicy::Outside;
+				}
+			}
+			vk::AttachmentStoreOp store = (needed_after && (written[access.resource] || had_contents[access.resource])) ?
+										  vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+			bool stencil = bool(AspectOf(resource.format) & vk::ImageAspectFlagBits::eStencil);
+			attachment_of[access.resource] = attachments.size();
+			attachments.push_back(vk::AttachmentDescription(
+				vk::AttachmentDescriptionFlags(), resource.format, resource.samples, load, store,
+				stencil ? load : vk::AttachmentLoadOp::eDontCare, stencil ? store : vk::AttachmentStoreOp::eDontCare,
+				layout, layout));
+			views.push_back(resource.view);
+			clear_values.push_back(access.clear_value);
+			extent = vk::Extent2D(min(extent.width, resource.extent.width), min(extent.height, resource.extent.height));
+			if ((access.usage == FrameGraphUsage::ColorAttachment || access.usage == FrameGraphUsage::DepthAttachment) && !has_area){
+				area = resource.area;
+				has_area = true;
+			}
+		}
+	}
+	if (!has_area){
+		area = vk::Rect2D(vk::Offset2D(), extent);
+	}
+
+	// Loads and stores move every sample of the render area, resolves write every pixel of it
+	uint64_t pixels = uint64_t(area.extent.width) * area.extent.height;
+	for (auto resource : used){
+		if (!attachment_of.count(resource)){ continue; }
+		vk::AttachmentDescription & attachment = attachments[attachment_of[resource]];
+		uint64_t bytes = pixels * uint32_t(attachment.samples) * TexelSize(attachment.format);
+		bool resolve_target = false;
+		for (auto & accesses : subpass_accesses){
+			for (auto & access : accesses){
+				resolve_target = resolve_target || (access.resource == resource && access.usage == FrameGraphUsage::ResolveAttachment);
+			}
+		}
+		if (attachment.loadOp == vk::AttachmentLoadOp::eLoad){ traffic.loaded += bytes; }
+		if (attachment.storeOp == vk::AttachmentStoreOp::eStore || resolve_target){ traffic.stored += bytes; }
+	}
+
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+	// With dynamic rendering, a pass renders straight into the views (input attachments still need a render pass)
+	bool reads_inputs = false;
+	for (auto & access : subpass_accesses.front()){
+		reads_inputs = reads_inputs || access.usage == FrameGraphUsage::InputAttachment;
+	}
+	if (renderer->UsesDynamicRendering() && group.size() == 1 && !reads_inputs){
+		vector<vk::RenderingAttachmentInfoKHR> color_attachments;
+		vk::RenderingAttachmentInfoKHR depth_attachment;
+		for (auto & access : subpass_accesses.front()){
+			Resource & resource = resources[access.resource];
+			vk::AttachmentDescription & attachment = attachments[attachment_of[access.resource]];
+			auto rendering_attachment = vk::RenderingAttachmentInfoKHR(
+				resource.view, Info(access.usage).layout, vk::ResolveModeFlagBits::eNone, nullptr, vk::ImageLayout::eUndefined,
+				attachment.loadOp, attachment.storeOp, access.clear_value);
+			if (access.usage == FrameGraphUsage::ColorAttachment){
+				color_attachments.push_back(rendering_attachment);
+				current_color_formats.push_back(resource.format);
+			}
+			else if (access.usage == FrameGraphUsage::DepthAttachment){
+				depth_attachment = rendering_attachment;
+				current_depth_format = resource.format;
+			}
+		}
+		// ..resolve attachments go with the color attachments in the order both were added
+		size_t resolved = 0;
+		for (auto & access : subpass_accesses.front()){
+			if (access.usage != FrameGraphUsage::ResolveAttachment || resolved >= color_attachments.size()){ continue; }
+			color_attachments[resolved].resolveMode = vk::ResolveModeFlagBits::eAverage;
+			color_attachments[resolved].resolveImageView = resources[access.resource].view;
+			color_attachments[resolved].resolveImageLayout = Info(access.usage).layout;
+			resolved++;
+		}
+
+		bool has_depth = current_depth_format != vk::Format::eUndefined;
+		bool has_stencil = has_depth && bool(AspectOf(current_depth_format) & vk::ImageAspectFlagBits::eStencil);
+		command_buffer.beginRenderingKHR(
+			vk::RenderingInfoKHR(
+				vk::RenderingFlagsKHR(), area, 1, 0,
+				color_attachments.size(), color_attachments.data(),
+				has_depth ? &depth_attachment : nullptr,
+				has_stencil ? &depth_attachment : nullptr),
+			renderer->dldid);
+		passes[group.front()].execute(command_buffer);
+		command_buffer.endRenderingKHR(renderer->dldid);
+		current_color_formats.clear();
+		current_depth_format = vk::Format::eUndefined;
+		return;
+	}
+#endif
+
+	// ..the references have to stay put until the render pass is made
+	size_t subpass_count = subpass_accesses.size();
+	vector<vector<vk::AttachmentReference>> color_references(subpass_count), input_references(subpass_count), resolve_references(subpass_count);
+	vector<vk::AttachmentReference> depth_references(subpass_count);
+	vector<vector<uint32_t>> preserved(subpass_count);
+	vector<vk::SubpassDescription> subpasses;
+	for (size_t s = 0; s < subpass_count; s++){
+		bool has_depth = false;
+		for (auto & access : subpass_accesses[s]){
+			vk::AttachmentReference reference(uint32_t(attachment_of[access.resource]), Info(access.usage).layout);
+			if (access.usage == FrameGraphUsage::ColorAttachment){ color_references[s].push_back(reference); }
+			else if (access.usage == FrameGraphUsage::DepthAttachment){ depth_references[s] = reference; has_depth = true; }
+			else if (access.usage == FrameGraphUsage::ResolveAttachment){ resolve_references[s].push_back(reference); }
+			else { input_references[s].push_back(reference); }
+		}
+		// ..color attachments without a resolve attachment of their own aren't resolved
+		bool resolves = !resolve_references[s].empty();
+		resolve_references[s].resize(color_references[s].size(), vk::AttachmentReference(VK_ATTACHMENT_UNUSED, vk::ImageLayout::eUndefined));
+		// ..attachments used before and after a subpass that doesn't use them have to be kept through it
+		for (auto resource : used){
+			auto uses = [&](size_t subpass){
+				for (auto & access : subpass_accesses[subpass]){
+					if (access.resource == resource){ return true; }
+				}
+				return false;
+			};
+			bool before = false, after = false;
+			for (size_t t = 0; t < s; t++){ before = before || uses(t); }
+			for (size_t t = s + 1; t < subpass_count; t++){ after = after || uses(t); }
+			if (before && after && !uses(s)){ preserved[s].push_back(uint32_t(attachment_of[resource])); }
+		}
+		subpasses.push_back(vk::SubpassDescription(
+			vk::SubpassDescriptionFlags(), vk::PipelineBindPoint::eGraphics,
+			input_references[s].size(), input_references[s].data(),
+			color_references[s].size(), color_references[s].data(),
+			resolves ? resolve_references[s].data() : nullptr, has_depth ? &depth_references[s] : nullptr,
+			preserved[s].size(), preserved[s].data()));
+	}
+
+	// A subpass depends on the last one before it to use each of its attachments, when either of them writes it.
+	// They're by region: a subpass only reads its own pixel of an input attachment, so tiles can finish one at a time.
+	map<pair<uint32_t, uint32_t>, vk::SubpassDependency> dependencies;
+	for (size_t s = 1; s < subpass_count; s++){
+		for (auto & access : subpass_accesses[s]){
+			for (size_t t = s; t-- > 0;){
+				auto earlier = find_if(subpass_accesses[t].begin(), subpass_accesses[t].end(), [&](const Access & other){
+					return other.resource == access.resource; });
+				if (earlier == subpass_accesses[t].end()){ continue; }
+				if (earlier->write || access.write){
+					UsageInfo src = Info(earlier->usage), dst = Info(access.usage);
+					auto & dependency = dependencies[make_pair(uint32_t(t), uint32_t(s))];
+					dependency.srcSubpass = uint32_t(t);
+					dependency.dstSubpass = uint32_t(s);
+					dependency.srcStageMask |= src.stages;
+					dependency.dstStageMask |= dst.stages;
+					dependency.srcAccessMask |= earlier->write ? src.access : vk::AccessFlags();
+					dependency.dstAccessMask |= dst.access;
+					dependency.dependencyFlags = vk::DependencyFlagBits::eByRegion;
+				}
+				break;
+			}
+		}
+	}
+	vector<vk::SubpassDependency> subpass_dependencies;
+	for (auto & dependency : dependencies){
+		subpass_dependencies.push_back(dependency.second);
+	}
+
+	current_render_pass = renderer->GetRenderPass(attachments, subpasses, subpass_dependencies);
+	command_buffer.beginRenderPass(
+		vk::RenderPassBeginInfo(
+			current_render_pass,
+			renderer->GetFramebuffer(current_render_pass, views, extent),
+			area,
+			clear_values.size(),
+			clear_values.data()),
+		vk::SubpassContents::eInline, renderer->dldid);
+	for (size_t s = 0; s < subpass_count; s++){
+		if (s > 0){
+			command_buffer.nextSubpass(vk::SubpassContents::eInline, renderer->dldid);
+		}
+		current_subpass = uint32_t(s);
+		passes[group[s]].execute(command_buffer);
+	}
+	command_buffer.endRenderPass(renderer->dldid);
+	current_render_pass = nullptr;
+	current_subpass = 0;
+}
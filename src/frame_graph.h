@@ -0,0 +1,190 @@
+#pragma once
+#include "renderer.h"
+
+// Frame Graph
+// A frame is described as passes that read and write named images and buffers, and the graph works out the rest:
+//   - passes that nothing kept depends on are culled (passes writing an imported resource are always kept)
+//   - the rest run in dependency order, passes that don't depend on each other stay in the order they were added
+//   - before each pass, one pipeline barrier makes everything it uses ready (layout transitions included)
+//   - a pass that writes color or depth attachments gets a render pass (and framebuffer) from the renderer's caches.
+//     Passes after it that only use attachments (of the same size), and read what it drew as input attachments, become
+//     its next subpasses (with by region dependencies), so on tiling GPUs a G-buffer and its lighting stay on chip.
+//     When the renderer uses dynamic rendering, passes without input attachments render straight into the views
+//     instead, with no render pass or framebuffer objects at all.
+//   - transient resources are allocated by the graph, in one heap where resources that are never alive at the same
+//     time share memory. They're kept from frame to frame while the frames declare the same ones. Attachments used by
+//     a single render pass are never stored, and get lazily allocated memory where the device has it (tiling GPUs), so
+//     multisampled attachments that are resolved in the pass may never get memory at all.
+// Imported resources belong to someone else (the swapchain images, for example), their contents are kept.
+enum class FrameGraphUsage {
+	ColorAttachment,
+	DepthAttachment,
+	InputAttachment,
+	ResolveAttachment, // the multisampled color attachments of the pass resolve into these, in the order both were added
+	SampledFragment,   // sampled in a fragment shader
+	SampledCompute,    // sampled in a compute shader
+	StorageRead,       // storage image or buffer, in a compute shader
+	StorageWrite,
+	TransferSrc,
+	TransferDst,
+	UniformRead,       // buffers only
+};
+
+// Attachment Policy
+// What a pass knows about a resource it writes that the graph can't work out. The load and store ops (and whether a
+// layout transition keeps the old contents) follow from it:
+//   - previous contents not needed: nothing is loaded, the image goes from an undefined layout (a pass covering
+//     every pixel should say so, or the old contents are loaded whenever there are any)
+//   - consumed by the graph: stored only if it's imported or a later pass uses it. By outside: always stored (read
+//     back, or used by the next frame). By nobody: never stored, even when imported.
+struct AttachmentPolicy {
+	enum Consumer { Graph, Outside, Nobody };
+	bool needs_previous_contents = true;
+	Consumer consumed_by = Graph;
+};
+
+class FrameGraph {
+	public:
+		struct ImportedImage {
+			vk::Image image;
+			vk::ImageView view;
+			vk::Format format;
+			vk::Extent2D extent;
+			vk::Rect2D area;                                         // the part drawn into, all of it when empty
+			vk::ImageLayout initial_layout = vk::ImageLayout::eUndefined;
+			vk::PipelineStageFlags initial_stages;                   // ..what has to finish (or be waited on) before it's used
+			vk::AccessFlags initial_access;
+			vk::ImageLayout final_layout = vk::ImageLayout::eUndefined; // left as the last pass had it when undefined
+		};
+
+		class PassBuilder {
+			public:
+				void Read(string resource, FrameGraphUsage usage);
+				void Write(string resource, FrameGraphUsage usage, AttachmentPolicy policy = AttachmentPolicy());
+				// ..An attachment written by clearing it first
+				void Write(string resource, FrameGraphUsage usage, vk::ClearValue clear, AttachmentPolicy policy = AttachmentPolicy());
+			private:
+				friend class FrameGraph;
+				FrameGraph * graph;
+				size_t pass;
+				void Access(string resource, FrameGraphUsage usage, bool write, bool clear, vk::ClearValue clear_value, AttachmentPolicy policy);
+		};
+
+		FrameGraph(VkRenderer * renderer);
+		~FrameGraph();
+
+		// ..Starts declaring a new frame
+		void Reset();
+		void CreateImage(string name, vk::Format format, vk::Extent2D extent, vk::Rect2D area = vk::Rect2D(),
+						 vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1);
+		void CreateBuffer(string name, vk::DeviceSize size);
+		void ImportImage(string name, const ImportedImage & image);
+		void ImportBuffer(string name, vk::Buffer buffer, vk::DeviceSize size);
+		// ..before_barriers is recorded ahead of the barriers that make the pass's resources ready (so it doesn't wait for them)
+		void AddPass(string name, function<void(PassBuilder &)> setup, function<void(vk::CommandBuffer)> execute,
+					 function<void(vk::CommandBuffer)> before_barriers = nullptr);
+
+		// ..Compiles the frame (allocating transients if they changed) and records every pass that's kept
+		void Execute(vk::CommandBuffer command_buffer);
+
+		// ..The physical resources, for the passes' execute functions
+		vk::Image GetImage(string name);
+		vk::ImageView GetImageView(string name);
+		vk::Buffer GetBuffer(string name);
+		vk::Rect2D GetArea(string name);
+		vk::Extent2D GetExtent(string name);
+		// ..The render pass and subpass the current pass records into (null outside of attachment writing passes,
+		// ..and with dynamic rendering)
+		vk::RenderPass CurrentRenderPass() const { return current_render_pass; }
+		uint32_t CurrentSubpass() const { return current_subpass; }
+		// ..pipelines[name], made for what the current pass draws into (its render pass and subpass, or its formats)
+		vk::Pipeline GetPipeline(string name);
+
+		// ..Estimated bytes the last frame's attachments loaded from and stored (or resolved) to memory
+		struct AttachmentTraffic {
+			uint64_t loaded = 0;
+			uint64_t stored = 0;
+		};
+		AttachmentTraffic Traffic() const { return traffic; }
+
+	private:
+		struct Resource {
+			string name;
+			bool image = true;
+			bool imported = false;
+			vk::Format format = vk::Format::eUndefined;
+			vk::Extent2D extent;
+			vk::Rect2D area;
+			vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+			vk::DeviceSize size = 0;
+			ImportedImage import;
+			vk::ImageUsageFlags image_usage;
+			vk::BufferUsageFlags buffer_usage;
+			// ..physical
+			vk::Image vk_image;
+			vk::ImageView view;
+			vk::Buffer buffer;
+			// ..while compiling and recording
+			int first_pass = -1, last_pass = -1;
+			bool has_contents = false;
+			vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+			vk::PipelineStageFlags write_stages, read_stages, visible_stages;
+			vk::AccessFlags write_access, visible_access;
+		};
+		struct Access {
+			size_t resource;
+			FrameGraphUsage usage;
+			bool write;
+			bool clear;
+			vk::ClearValue clear_value;
+			AttachmentPolicy policy;
+		};
+		struct Pass {
+			string name;
+			vector<Access> accesses;
+			function<void(vk::CommandBuffer)> execute;
+			bool kept = false;
+			function<void(vk::CommandBuffer)> before_barriers;
+		};
+		// Transients stay allocated while each frame declares the same ones (with the same lifetimes)
+		struct Transient {
+			vk::Image image;
+			vk::ImageView view;
+			vk::Buffer buffer;
+			vma::Allocation allocation;      // only when it didn't fit in the shared heap
+			vk::DeviceSize offset = 0, size = 0;
+			int first_pass, last_pass;
+			vk::PipelineStageFlags last_stages; // of the frame before, the next frame's first use waits for these
+			vk::AccessFlags last_writes;
+		};
+
+		VkRenderer * renderer;
+		vector<Resource> resources;
+		map<string, size_t> resource_names;
+		vector<Pass> passes;
+		vector<size_t> order;
+		vector<vector<size_t>> groups; // the passes in order, split into render passes (one pass each, unless they're subpasses)
+		vector<int> group_of;          // by position in order
+		string transient_key;
+		map<string, Transient> transients;
+		vma::Allocation heap = nullptr;
+		vk::RenderPass current_render_pass = nullptr;
+		uint32_t current_subpass = 0;
+		AttachmentTraffic traffic;
+		vector<vk::Format> current_color_formats; // with dynamic rendering
+		vk::Format current_depth_format = vk::Format::eUndefined;
+
+		size_t Find(string name);
+		size_t AddResource(string name);
+		void Compile();
+		void AllocateTransients();
+		void ReleaseTransients();
+		bool Aliases(const Transient & a, const Transient & b) const; // ..share memory (a transient aliases itself)
+		void Barrier(Resource & resource, FrameGraphUsage usage, bool write, bool discard, vector<vk::ImageMemoryBarrier> & image_barriers,
+					 vector<vk::BufferMemoryBarrier> & buffer_barriers, vk::PipelineStageFlags & src_stages, vk::PipelineStageFlags & dst_stages);
+		vector<Access> MergedAccesses(const Pass & pass);
+		bool JoinsSubpasses(const vector<size_t> & group, size_t pass);
+		void CreateTransientViews();
+		// ..last_position is the group's last pass, in order
+		void RecordPasses(vk::CommandBuffer command_buffer, const vector<size_t> & group, int last_position);
+};
@@ -0,0 +1,107 @@
+#include "frame_pacing.h"
+
+#include <chrono>
+#include <thread>
+
+// How long a wait for a frame can take before pacing gives up on it (a lost present shouldn't hang the loop)
+static const uint64_t FRAME_TIMEOUT = 1000000000; // 1s
+// Queue length changes are spaced out, so one slow frame doesn't swing it back and forth
+static const int FRAMES_BETWEEN_CHANGES = 60;
+
+FramePacer::FramePacer(VkRenderer * renderer, uint32_t max_queued_frames) : max_queued_frames(max_queued_frames), renderer(renderer) {}
+
+double FramePacer::Milliseconds(uint64_t ticks) const
+{
+	return double(ticks) * 1000.0 / double(SDL_GetPerformanceFrequency());
+}
+
+void FramePacer::BeginFrame()
+{
+	// A frame that didn't get submitted (the swapchain was out of date) samples its input again
+	if (!pending.empty() && pending.back().frame > renderer->frame_count){
+		pending.pop_back();
+	}
+
+	// Frames that have finished are picked up without blocking. Their time is when they were noticed (up to a frame
+	// after they were shown), so it's only an estimate even when they were presented
+	bool presented = false;
+	while (!pending.empty() && renderer->WaitForFrame(pending.front().frame, 0, &presented)){
+		Complete(pending.front(), SDL_GetPerformanceCounter(), false);
+		pending.pop_front();
+	}
+	// ..then the oldest ones are waited on until there's room for another
+	while (!pending.empty() && pending.size() >= max_queued_frames){
+		if (!renderer->WaitForFrame(pending.front().frame, FRAME_TIMEOUT, &presented)){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Frame %llu wasn't shown in time, no longer pacing it",
+				(unsigned long long)pending.front().frame);
+			pending.pop_front();
+			continue;
+		}
+		Complete(pending.front(), SDL_GetPerformanceCounter(), presented);
+		pending.pop_front();
+	}
+
+	AdjustQueue();
+	AdjustInputDelay();
+	if (delay_input && measured && input_delay > 0.0){
+		this_thread::sleep_for(chrono::duration<double, milli>(input_delay));
+	}
+
+	pending.push_back({renderer->frame_count + 1, SDL_GetPerformanceCounter()});
+}
+
+void FramePacer::Complete(const PendingFrame & frame, uint64_t ticks, bool exact)
+{
+	frames_since_change++;
+	// Estimates are left out while present times keep coming in, and taken again once they've stopped for a while
+	frames_since_exact = exact ? 0 : frames_since_exact + 1;
+	if (!exact && measured && frames_since_exact < FRAMES_BETWEEN_CHANGES){ return; }
+	if (exact != measured){
+		// ..the averages start over, present times and estimates don't mix
+		latency = 0.0;
+		last_present = 0;
+	}
+	measured = exact;
+
+	double sample = Milliseconds(ticks - frame.input_ticks);
+	latency = (latency > 0.0) ? latency * 0.9 + sample * 0.1 : sample;
+
+	// ..frames left out in between count towards the interval, spread over all of them
+	missed_refresh = false;
+	if (last_present){
+		double interval = Milliseconds(ticks - last_present) / double(max<uint64_t>(frame.frame - last_frame, 1));
+		missed_refresh = frame_interval > 0.0 && interval > frame_interval * 1.5;
+		frame_interval = (frame_interval > 0.0) ? frame_interval * 0.95 + interval * 0.05 : interval;
+	}
+	last_present = ticks;
+	last_frame = frame.frame;
+}
+
+void FramePacer::AdjustQueue()
+{
+	if (latency_target <= 0.0 || frames_since_change < FRAMES_BETWEEN_CHANGES){ return; }
+	if (latency > latency_target && max_queued_frames > 1){
+		max_queued_frames--;
+		frames_since_change = 0;
+	}
+	else if (latency < latency_target * 0.5 && int(max_queued_frames) < renderer->buffer_count){
+		max_queued_frames++;
+		frames_since_change = 0;
+	}
+}
+
+void FramePacer::AdjustInputDelay()
+{
+	// The delay creeps up while every frame makes its refresh, and is halved as soon as one doesn't
+	if (!delay_input || !measured){
+		input_delay = 0.0;
+		return;
+	}
+	if (missed_refresh){
+		input_delay *= 0.5;
+		missed_refresh = false;
+	}
+	else {
+		input_delay = min(input_delay + 0.05, frame_interval * 0.75);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "renderer.h"
+
+#include <deque>
+
+// Frame Pacing
+// Keeps the CPU from running too far ahead of the display, and measures the latency from sampling input to the
+// frame being shown. With VK_KHR_present_wait the time each frame is presented is known, otherwise it's estimated
+// from when the CPU sees the frame's rendering finish (which leaves out the wait for scanout).
+//   max_queued_frames - frames submitted but not yet shown, BeginFrame waits until there's room for one more
+//   latency_target    - when set, max_queued_frames is lowered while the latency is over it, and raised again
+//                       (for throughput) while it's well under it
+//   delay_input       - sleeps before input is sampled, as long as frames keep making their refresh, so the input
+//                       is as fresh as possible when the frame is shown (needs present times, ignored without them)
+class FramePacer {
+	public:
+		uint32_t max_queued_frames;
+		double latency_target = 0.0; // ms, 0 leaves max_queued_frames alone
+		bool delay_input = false;
+
+		FramePacer(VkRenderer * renderer, uint32_t max_queued_frames = 2);
+
+		// ..Call every frame right before polling input, returns once the next frame can be made
+		void BeginFrame();
+
+		double Latency() const { return latency; }        // ms from input to present, averaged over recent frames
+		double InputDelay() const { return input_delay; } // ms slept before sampling input
+		bool Measured() const { return measured; }        // whether the latency comes from present times (waited on as they happened)
+	private:
+		struct PendingFrame {
+			uint64_t frame;
+			uint64_t input_ticks;
+		};
+
+		VkRenderer * renderer;
+		deque<PendingFrame> pending; // frames whose input has been sampled, oldest first
+		double latency = 0.0;
+		double frame_interval = 0.0; // ms between presents, averaged
+		double input_delay = 0.0;
+		uint64_t last_present = 0;
+		uint64_t last_frame = 0;     // the frame last_present is the time of
+		int frames_since_exact = 0;  // frames completed since the last one timed at its present
+		bool missed_refresh = false;
+		bool measured = false;
+		int frames_since_change = 0;
+
+		double Milliseconds(uint64_t ticks) const;
+		// ..exact when ticks is the time the frame was presented (rather than when it was noticed, or finished rendering)
+		void Complete(const PendingFrame & frame, uint64_t ticks, bool exact);
+		void AdjustQueue();
+		void AdjustInputDelay();
+};
@@ -1,4 +1,10 @@
 #include "renderer.h"
+#include "streaming.h"
+#include "batching.h"
+#include "shader_watcher.h"
+#include "frame_pacing.h"
+#include "frame_graph.h"
+#include "post_processing.h"
 #include <cmath>
 
 constexpr double PI = 3.14159265358979323846;
@@ -12,94 +18,85 @@ int WIDTH, HEIGHT;
 
 int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is the entry point.
 {
+	StartupTrace::Start();
 	SDL_Init(SDL_INIT_VIDEO);       //This activates a specific SDL2 subsystem  
+	SDL_Vulkan_LoadLibrary(NULL);   //...loaded up front, so the renderer can start before the window exists
 
 	//Forward Declerations
 	SDL_Event event;          //This is the handle for the event subsystem
-	SDL_Window * window;      //This is a handle for the window
-	VkRenderer * renderer;    //This is a handle for the renderer
+	SDL_Window * window = nullptr;      //This is a handle for the window
+	VkRenderer * renderer = nullptr;    //This is a handle for the renderer
+	AssetStreamer * streamer = nullptr;
+	AssetHandle triangle = 0;
+	StaticBatcher * scenery = nullptr; //Meshes that never change, one draw for all of them
+	PostProcessing * post = nullptr;   //Compute passes between the scene and the swapchain
 	WIDTH = 640, HEIGHT = 480;
 	bool running = true;
 
-	//Creating a window
-	 window = SDL_CreateWindow("Vulkan Application", SDL_WINDOWPOS_UNDEFINED,
-		SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_VULKAN|SDL_WINDOW_RESIZABLE);
-
-	if (!window){
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Application Error!", SDL_GetError(), NULL);
-		return -1;
-	}
-
-	//Creating a renderer
-	 renderer = new VkRenderer(window);
-
 	//Variables
 	float dt = 0.0f;
 	float rotator = 0.0f;
+	string mesh_path = (argc > 1) ? argv[1] : "meshes/triangle.vkm";
+	vector<string> scenery_paths(argv + min(argc, 2), argv + argc); // ..every mesh after the first is static scenery
 
-	//Triangle Vertices and Vertex Buffer
-	vector<Vertex> vertices = {
-		//{{position}, {color}}
-		{{0.0f, -0.5f},{0.0f, 0.0f, 0.0f}}, 
-		{{0.5f,  0.5f},{0.0f, 0.0f, 0.0f}},
-		{{-0.5,  0.5f},{0.0f, 0.0f, 0.0f}},
-	};
+	//Startup
+	// ...runs as a dependency graph: the driver starts up while the window is created, the shaders compile and
+	// ...the first mesh is read from disk, and only the steps that need all of those wait for them.
+	InitGraph startup;
 
-	auto triangle = new VertexBuffer(vertices, renderer);
+	//Creating a window
+	startup.Add("Create Window", {}, [&]{
+		window = SDL_CreateWindow("Vulkan Application", SDL_WINDOWPOS_UNDEFINED,
+			SDL_WINDOWPOS_UNDEFINED, WIDTH, HEIGHT, SDL_WINDOW_VULKAN|SDL_WINDOW_RESIZABLE);
+		if (!window){
+			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Application Error!", SDL_GetError(), NULL);
+			throw runtime_error("window creation error");
+		}
+	}, true);
 
-	//Command Buffers
-	auto command_buffers = renderer->GetCommandBuffers(vk::CommandBufferLevel::ePrimary, renderer->buffer_count);
+	//Creating a renderer
+	startup.Add("Create Renderer", {}, [&]{ renderer = new VkRenderer(); });
 
-	uint32_t i = 0;
+	//Shaders are compiled on every core at once the first time, and loaded from the shader cache after that
+	startup.Add("Compile Shaders", {}, [&]{
+		ShaderCompiler().Precompile({{"uncompiled_shaders/triangle.vert", {}}, {"uncompiled_shaders/triangle.frag", {}},
+									 {"uncompiled_shaders/blur.comp", {}}, {"uncompiled_shaders/tonemap.comp", {}}, {"uncompiled_shaders/grade.comp", {}},
+									 {"uncompiled_shaders/hdr10.comp", {}}});
+	});
+
+	//The first mesh gets pulled into the page cache, so the streamer's upload doesn't wait on the disk
+	startup.Add("Prefetch Mesh", {}, [&]{
+		try { MeshFile prefetch(mesh_path, false); }
+		catch (const runtime_error &) {} // ..the streamer reports it
+	});
+
+	startup.Add("Create Presentation", {"Create Window", "Create Renderer"}, [&]{ renderer->CreatePresentation(window); }, true);
 
-	//Vertex Buffer
+	//Asset Streaming, meshes load in the background and at most 256MB of geometry stays on the GPU
+	startup.Add("Start Streamer", {"Create Renderer"}, [&]{
+		streamer = new AssetStreamer(renderer, 256 << 20);
+		triangle = streamer->Request(mesh_path);
+	});
 
 	//Triangle Pipeline Creation
-	{
-		auto vertex_shader = renderer->LoadShaderModule("shaders/triangle.vert.spv");
-		auto fragment_shader = renderer->LoadShaderModule("shaders/triangle.frag.spv");
-
-		vector<vk::PipelineShaderStageCreateInfo> shader_stages = {
-			vk::PipelineShaderStageCreateInfo(       //VERTEX SHADER
-				vk::PipelineShaderStageCreateFlags(),
-				vk::ShaderStageFlagBits::eVertex,
-				vertex_shader, "main"),
-
-			vk::PipelineShaderStageCreateInfo(      //FRAGMENT SHADER
-				vk::PipelineShaderStageCreateFlags(), 
-				vk::ShaderStageFlagBits::eFragment, 
-				fragment_shader, "main")
+	startup.Add("Create Pipelines", {"Create Presentation", "Compile Shaders"}, [&]{
+		//Post Processing, first: it picks the format the scene (and so the triangle pipeline) draws in
+		post = new PostProcessing(renderer);
+
+		GraphicsPipelineInfo triangle_pipeline;
+		triangle_pipeline.shaders = {
+			{vk::ShaderStageFlagBits::eVertex, "uncompiled_shaders/triangle.vert"},   //VERTEX SHADER
+			{vk::ShaderStageFlagBits::eFragment, "uncompiled_shaders/triangle.frag"}, //FRAGMENT SHADER
 		};
 
-		const vk::VertexInputBindingDescription vertex_binding_description = Vertex::GetBindingDescription();
-		const vector<vk::VertexInputAttributeDescription> vertex_attribute_description = Vertex::GetAttributeDescription();
-		auto vertex_input_info = 
-		vk::PipelineVertexInputStateCreateInfo(
-			vk::PipelineVertexInputStateCreateFlags(),
-			1, &vertex_binding_description,
-			static_cast<uint32_t>(Vertex::GetAttributeDescription().size()),
-			vertex_attribute_description.data()
-		);
-
-		auto input_assembly = 
-		vk::PipelineInputAssemblyStateCreateInfo(
-			vk::PipelineInputAssemblyStateCreateFlags(),
-			vk::PrimitiveTopology::eTriangleList,
-			VK_FALSE
-		);
+		triangle_pipeline.vertex_bindings = {Vertex::GetBindingDescription()};
+		triangle_pipeline.vertex_attributes = Vertex::GetAttributeDescription();
+		triangle_pipeline.topology = vk::PrimitiveTopology::eTriangleList;
 
 		//Viewport and Scissor
 		renderer->viewports.push_back(vk::Viewport(0, 0, WIDTH, HEIGHT, 0, 1.0f));
 		renderer->scissors.push_back(vk::Rect2D(vk::Offset2D(), vk::Extent2D(WIDTH, HEIGHT)));
 
-		auto viewport_state = vk::PipelineViewportStateCreateInfo(
-			vk::PipelineViewportStateCreateFlags(), 
-			renderer->viewports.size(),
-			renderer->viewports.data(),
-			renderer->scissors.size(),
-			renderer->scissors.data()
-		);
-
 		//Rasterizer
 		renderer->rasterizer.setDepthClampEnable(VK_FALSE);
 		renderer->rasterizer.setRasterizerDiscardEnable(VK_FALSE);
@@ -119,11 +116,11 @@ int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is t
 		//...Everything else just needs the defaults, but I labled where I would add the options
 
 		//Depth and Stencil Tests
-		auto depth_stencil_tests = vk::PipelineDepthStencilStateCreateInfo();
+		triangle_pipeline.depth_stencil_tests = vk::PipelineDepthStencilStateCreateInfo();
 		//...Default is no tests
 
 		//Color Blending - (The fragment shader's color needs to be combined with a color in a framebuffer)
-		vector<vk::PipelineColorBlendAttachmentState> blend_attachments = {
+		triangle_pipeline.blend_attachments = {
 			vk::PipelineColorBlendAttachmentState(
 				VK_TRUE, vk::BlendFactor::eSrcAlpha,		   //blendEnable, srcColorBlendFactor
 				vk::BlendFactor::eZero, vk::BlendOp::eAdd,	   //dstColorBlendFacctor, colorBlendOp
@@ -134,54 +131,53 @@ int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is t
 				vk::ColorComponentFlagBits::eB |
 				vk::ColorComponentFlagBits::eA) 
 		};
-
-		auto color_blend = 
-		vk::PipelineColorBlendStateCreateInfo(
-			vk::PipelineColorBlendStateCreateFlags(),
-			VK_FALSE, vk::LogicOp::eCopy, //LogicOpEnable, LogicOp
-			blend_attachments.size(),     //AttachmentCount
-			blend_attachments.data()      //Attachments
-		);
 		
 		//Dynamic States
-		vector<vk::DynamicState> dynamic_states = {
+		triangle_pipeline.dynamic_states = {
 			vk::DynamicState::eViewport,
 			vk::DynamicState::eScissor,
 			vk::DynamicState::eLineWidth,
 		};
 
-		auto pipeline_dynamic_states = 
-		vk::PipelineDynamicStateCreateInfo(
-			vk::PipelineDynamicStateCreateFlags(),
-			dynamic_states.size(),
-			dynamic_states.data()
-		);
-
 		//Pipeline Layout
-		auto pipeline_layout_info = vk::PipelineLayoutCreateInfo();
-		// ...Defaults are nothing, which is perfect as descriptor layouts aren't being used yet
-
-		renderer->pipeline_layout = renderer->device->createPipelineLayout(pipeline_layout_info).value;
+		// ...left empty, the renderer reflects it from the shaders (which use no descriptors yet)
 
 		//Pipeline Object
-		renderer->pipelines["Triangle"] =
-			renderer->device->createGraphicsPipeline(
-				nullptr, 
-				vk::GraphicsPipelineCreateInfo(
-					vk::PipelineCreateFlags(), 
-					shader_stages.size(), shader_stages.data(),    //stageCount, shaderStages
-					&vertex_input_info, &input_assembly, nullptr,  //vertexInputState, inputAssemblyState, tesselationState
-					&viewport_state, &renderer->rasterizer,        //viewportState, rasterizationState
-					&renderer->multisampler, &depth_stencil_tests, //multisampleState, depthStencilTests, 
-					&color_blend, &pipeline_dynamic_states,        //colorblendState, pipelineDynamicStates,
-					renderer->pipeline_layout, renderer->renderpass,//pipelineLayout, renderPass
-					0, nullptr, -1)                                             //subPass
-		).value;
-
-		renderer->DestroyShaderModule("shaders/triangle.vert.spv");
-		renderer->DestroyShaderModule("shaders/triangle.frag.spv");
+		renderer->CreateGraphicsPipeline("Triangle", triangle_pipeline);
+	});
+
+	//Static scenery is merged into one buffer per pipeline, so it's a single draw however many meshes there are
+	startup.Add("Batch Scenery", {"Create Pipelines"}, [&]{
+		scenery = new StaticBatcher(renderer);
+		for (auto & path : scenery_paths){
+			try {
+				MeshFile mesh(path, false);
+				scenery->Add("Triangle", mesh);
+			}
+			catch (const runtime_error &) {} // ..logged already, the rest still load
+		}
+		scenery->Rebuild();
+	}, true);
+
+	try { startup.Run(); }
+	catch (...) {
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Startup failed");
+		return -1;
 	}
 
+	//Command Buffers
+	auto command_buffers = renderer->GetCommandBuffers(vk::CommandBufferLevel::ePrimary, renderer->buffer_count);
+
+	uint32_t i = 0;
+
+	//Frame Pacing, at most two frames queued ahead of the display (L switches to one, with input sampled as late as possible)
+	FramePacer pacer(renderer, 2);
+
+#ifdef VK_DEBUG
+	//Shader Hot Reload (debug builds only)
+	auto shader_watcher = new ShaderWatcher();
+#endif
+
 	//FPS Stuff
 	double last_time = SDL_GetTicks() / 1000;
 	float last_frame = SDL_GetTicks();
@@ -195,7 +191,11 @@ int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is t
 		if (print_fps) {
 			number_of_frames++;
 			if (current_time - last_time >= 1.0) {
-				printf("\n Framerate: %f \n", 1.0 * (double)number_of_frames);
+				auto traffic = renderer->frame_graph->Traffic();
+				printf("\n Framerate: %f, latency %.1fms (%s), GPU %.2fms at %.0f%% resolution, attachments %.1fMB loaded %.1fMB stored per frame \n",
+					1.0 * (double)number_of_frames, pacer.Latency(), pacer.Measured() ? "presented" : "estimated",
+					renderer->dynamic_resolution.gpu_time, renderer->dynamic_resolution.scale * 100.0,
+					traffic.loaded / 1048576.0, traffic.stored / 1048576.0);
 				number_of_frames = 0;
 				last_time += 1.0;
 			}
@@ -206,12 +206,37 @@ int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is t
 		last_frame = current_frame;
 
 		//Event Loop
+		pacer.BeginFrame(); // ..waits for room in the queue before input is read
 		while (SDL_PollEvent(&event)){
 			if (event.type == SDL_QUIT) {
 				running = false;
 				break;
 			}
 
+			//P cycles through the present policies
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_p && !event.key.repeat) {
+				renderer->SetPresentPolicy(PresentPolicy((int(renderer->GetPresentPolicy()) + 1) % 3));
+			}
+			//H cycles through the surface format policies (sRGB, HDR10, scRGB)
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_h && !event.key.repeat) {
+				renderer->SetSurfaceFormatPolicy(SurfaceFormatPolicy((int(renderer->GetSurfaceFormatPolicy()) + 1) % 3));
+			}
+			//M cycles through the MSAA sample counts (1, 2, 4, 8, as far as the GPU goes)
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_m && !event.key.repeat) {
+				vk::SampleCountFlagBits samples = renderer->GetSampleCount();
+				renderer->SetSampleCount(samples == vk::SampleCountFlagBits::e8 ? vk::SampleCountFlagBits::e1 : vk::SampleCountFlagBits(uint32_t(samples) * 2));
+				if (renderer->GetSampleCount() == samples){ renderer->SetSampleCount(vk::SampleCountFlagBits::e1); }
+			}
+			//E toggles the post processing (bloom, tonemapping and grading)
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_e && !event.key.repeat) {
+				post->SetEnabled(!post->Enabled());
+			}
+			//L toggles low latency pacing
+			if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_l && !event.key.repeat) {
+				pacer.delay_input = !pacer.delay_input;
+				pacer.max_queued_frames = pacer.delay_input ? 1 : 2;
+			}
+
 			if (event.type == SDL_WINDOWEVENT) {
 				if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
 
@@ -228,6 +253,15 @@ int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is t
 		}
 		//Game Logic
 		//...nothing's here... :p
+		streamer->Update();
+
+#ifdef VK_DEBUG
+		//Changed shaders are swapped in between frames
+		vector<string> changed_shaders = shader_watcher->TakeChanges();
+		if (!changed_shaders.empty()){
+			renderer->ReloadShaders(changed_shaders);
+		}
+#endif
 
 		 //Rendering Loop
 		 if (renderer->AcquireNextBuffer(i)) { //AcquireNextBuffer: acquires the next command buffer index, used for setting the render commands for the next swapchain.
@@ -236,47 +270,54 @@ int main(int argc, char ** argv) //Equivalent to WinMain() on Windows, this is t
 
 			 rotator += 0.001;
 
-			 vector<vk::ClearValue> clear_color = {
-				 vk::ClearColorValue(), // {depthStencil} indexed by attachments
-				 // The clear color passed to the swapchain when it renders
-				 vk::ClearColorValue(array<float, 4>{
-					 float(sin(rotator + CIRCLE_THIRD_1) * 0.5 + 0.5), //R  
-					 float(sin(rotator + CIRCLE_THIRD_2) * 0.5 + 0.5), //G 
-					 float(sin(rotator + CIRCLE_THIRD_3) * 0.5 + 0.5), //B  
-					 1.0f}), //A
-			 };
-
-			 command_buffers[i].begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
-			 command_buffers[i].beginRenderPass(
-				 vk::RenderPassBeginInfo(
-					renderer->renderpass,
-					renderer->frame_buffers[i],
-					renderer->render_area,
-					clear_color.size(),
-					clear_color.data())
-				, vk::SubpassContents::eInline);
-
-			 //at this point drawing commands can begin...
-			command_buffers[i].setViewport(0, renderer->viewports);
-			command_buffers[i].setScissor(0, renderer->scissors);
-			command_buffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, renderer->pipelines["Triangle"]);
-			vector<vk::Buffer> vertex_buffers = {triangle->vertex_buffer};
-			vector<vk::DeviceSize> offsets = {0};
-			command_buffers[i].bindVertexBuffers(0, vertex_buffers, offsets);
-			command_buffers[i].draw(vertices.size(), 1, 0, 0);
+			 vk::ClearColorValue clear_color(array<float, 4>{
+				 float(sin(rotator + CIRCLE_THIRD_1) * 0.5 + 0.5), //R  
+				 float(sin(rotator + CIRCLE_THIRD_2) * 0.5 + 0.5), //G 
+				 float(sin(rotator + CIRCLE_THIRD_3) * 0.5 + 0.5), //B  
+				 1.0f}); //A
+
+			 //BeginScene starts the frame graph's frame at the dynamic resolution scale, and sets the (scaled) viewports and scissors
+			 renderer->BeginScene(command_buffers[i], i);
+			 scenery->Rebuild(command_buffers[i]); // ..copies in whatever scenery changed, nothing when it didn't
+
+			 //at this point passes can be added...
+			renderer->frame_graph->AddPass("Triangle",
+				[&](FrameGraph::PassBuilder & pass){
+					pass.Write("Depth", FrameGraphUsage::DepthAttachment, vk::ClearDepthStencilValue(1.0f, 0));
+					if (renderer->GetSampleCount() != vk::SampleCountFlagBits::e1){
+						pass.Write("Scene Color MS", FrameGraphUsage::ColorAttachment, clear_color);
+						pass.Write("Scene Color", FrameGraphUsage::ResolveAttachment);
+					}
+					else {
+						pass.Write("Scene Color", FrameGraphUsage::ColorAttachment, clear_color);
+					}
+				},
+				[&](vk::CommandBuffer command_buffer){
+					command_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, renderer->frame_graph->GetPipeline("Triangle"), renderer->dldid);
+					if (auto triangle_buffer = streamer->Get(triangle)){
+						triangle_buffer->Draw(command_buffer);
+					}
+					scenery->Draw(command_buffer);
+				});
 
 			//...up until this point
-			command_buffers[i].endRenderPass();
-			command_buffers[i].end();
+			string shown = post->AddPasses();
+			renderer->EndScene(command_buffers[i], i, shown); // ..scales the (post processed) scene up into the swapchain image
 
 
 		//The function below sends the command buffer to the graphics queue to begin the rendering process,
 		//and when rendering is finished, it begins to present the rendered image to the corresponding swapchain
 		renderer->BeginRenderPresent(i, command_buffers);
+		StartupTrace::Finish(); // ..only the first call reports
 		 }
 	 }
 	renderer->device->waitIdle();
-	delete triangle;
+#ifdef VK_DEBUG
+	delete shader_watcher;
+#endif
+	delete streamer;
+	delete scenery;
+	delete post;
 	delete renderer;
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -0,0 +1,108 @@
+#include "mesh.h"
+#include <SDL2/SDL.h>
+#include <stdexcept>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MeshFile::MeshFile(string filename, bool show_errors) : path(filename), show_errors(show_errors)
+{
+#ifdef _WIN32
+	file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE){
+		file_handle = nullptr;
+		Fail("Can't open mesh, might not be in path");
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle, &file_size);
+	mapping_size = size_t(file_size.QuadPart);
+	if (mapping_size >= sizeof(MeshFileHeader)){
+		map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map_handle){
+			mapping = static_cast<const uint8_t *>(MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0));
+		}
+	}
+#else
+	file_descriptor = open(filename.c_str(), O_RDONLY);
+	if (file_descriptor < 0){
+		Fail("Can't open mesh, might not be in path");
+	}
+	struct stat file_info;
+	if (fstat(file_descriptor, &file_info) != 0){
+		Fail("Can't read the mesh file's size");
+	}
+	mapping_size = size_t(file_info.st_size);
+	if (mapping_size >= sizeof(MeshFileHeader)){
+		void * address = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+		if (address != MAP_FAILED){
+			mapping = static_cast<const uint8_t *>(address);
+			// the whole file is about to be copied front to back, so let the kernel read ahead
+			// (advice values aren't flags, each one is its own call)
+			madvise(address, mapping_size, MADV_SEQUENTIAL);
+			madvise(address, mapping_size, MADV_WILLNEED);
+		}
+	}
+#endif
+	if (!mapping){
+		Fail("Can't map mesh file (is it empty?)");
+	}
+
+	header = *reinterpret_cast<const MeshFileHeader *>(mapping);
+	if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION){
+		Fail("Not a mesh file, or it was written by a different version of mesh_convert");
+	}
+
+	// Every stream has to lie inside the file, and start aligned, otherwise the pointers handed out are garbage
+	// (written so a huge offset or size in a crafted header can't wrap around the checks)
+	uint64_t index_stride = (header.index_type == MESH_INDEX_UINT32) ? 4 : 2;
+	bool valid =
+		header.vertex_offset % MESH_STREAM_ALIGNMENT == 0 &&
+		header.index_offset % MESH_STREAM_ALIGNMENT == 0 &&
+		header.vertex_size == uint64_t(header.vertex_stride) * header.vertex_count &&
+		header.vertex_size <= mapping_size && header.vertex_offset <= mapping_size - header.vertex_size &&
+		header.index_type <= MESH_INDEX_UINT32 &&
+		(header.index_type == MESH_INDEX_NONE ? header.index_size == 0 : header.index_size == index_stride * header.index_count) &&
+		header.index_size <= mapping_size && header.index_offset <= mapping_size - header.index_size;
+	if (!valid){
+		Fail("Mesh file is corrupted or truncated");
+	}
+}
+
+MeshFile::~MeshFile()
+{
+	Unmap();
+}
+
+void MeshFile::Fail(string reason)
+{
+	Unmap();
+	if (show_errors){
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Asset Error!", string(reason + ": \n" + path).data(), NULL);
+	}
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "%s: %s", reason.c_str(), path.c_str());
+	throw runtime_error("failed to load mesh!");
+}
+
+void MeshFile::Unmap()
+{
+#ifdef _WIN32
+	if (mapping){ UnmapViewOfFile(mapping); }
+	if (map_handle){ CloseHandle(map_handle); }
+	if (file_handle){ CloseHandle(file_handle); }
+	map_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (mapping){ munmap(const_cast<uint8_t *>(mapping), mapping_size); }
+	if (file_descriptor >= 0){ close(file_descriptor); }
+	file_descriptor = -1;
+#endif
+	mapping = nullptr;
+}
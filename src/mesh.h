@@ -0,0 +1,65 @@
+#pragma once
+// Binary mesh container (.vkm files)
+// The layout is: a fixed header at the start of the file, then the vertex stream and the index stream,
+// each one beginning on a MESH_STREAM_ALIGNMENT boundary and padded up to the next one. The streams are
+// already in the layout the GPU reads (the Vertex struct in renderer.h), so the file can be mapped and
+// copied straight into a buffer without being parsed.
+// Files are produced by tools/mesh_convert.cpp.
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#define MESH_FILE_MAGIC 0x314D4B56 // "VKM1" read as a little endian integer
+#define MESH_FILE_VERSION 1
+#define MESH_STREAM_ALIGNMENT 4096 // page size, so each stream can be mapped or imported on its own
+
+enum MeshIndexType : uint32_t {
+	MESH_INDEX_NONE = 0,
+	MESH_INDEX_UINT16 = 1,
+	MESH_INDEX_UINT32 = 2,
+};
+
+struct MeshFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertex_stride; // bytes per vertex
+	uint32_t vertex_count;
+	uint32_t index_type;    // MeshIndexType
+	uint32_t index_count;
+	uint64_t vertex_offset; // byte offset of the vertex stream from the start of the file
+	uint64_t vertex_size;   // byte size of the vertex stream (without padding)
+	uint64_t index_offset;
+	uint64_t index_size;
+};
+static_assert(sizeof(MeshFileHeader) == 56, "MeshFileHeader is written to disk, its size can't change");
+
+// A .vkm file mapped into memory. The vertex and index pointers point into the mapping itself,
+// so the data is only ever copied once: from the page cache into GPU visible memory.
+class MeshFile {
+	public:
+		MeshFileHeader header = {};
+
+		// ..show_errors = false only throws, for loads running off the main thread
+		MeshFile(std::string filename, bool show_errors = true);
+		~MeshFile();
+		MeshFile(const MeshFile &) = delete;
+		MeshFile & operator=(const MeshFile &) = delete;
+
+		const void * Vertices() const { return mapping + header.vertex_offset; }
+		const void * Indices() const { return header.index_size ? mapping + header.index_offset : nullptr; }
+		const void * Mapping() const { return mapping; }
+		size_t MappingSize() const { return mapping_size; }
+	private:
+		std::string path;
+		bool show_errors;
+		const uint8_t * mapping = nullptr;
+		size_t mapping_size = 0;
+#ifdef _WIN32
+		void * file_handle = nullptr;
+		void * map_handle = nullptr;
+#else
+		int file_descriptor = -1;
+#endif
+		void Fail(std::string reason);
+		void Unmap();
+};
@@ -0,0 +1,150 @@
+#include "post_processing.h"
+
+// Every device can draw, sample, store to and blit this one
+static const vk::Format POST_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+// Workgroup sizes, as the shaders declare them
+static const uint32_t BLUR_TILE = 128;
+static const uint32_t PIXEL_GROUP = 8;
+
+// Push constants, laid out like the shaders' blocks
+struct BlurConstants {
+	glm::ivec2 size;
+	glm::vec2 source_scale;
+	glm::ivec2 direction;
+	float threshold;
+};
+
+struct TonemapConstants {
+	glm::ivec2 size;
+	glm::vec2 scene_scale;
+	glm::vec2 bloom_scale;
+	float exposure;
+	float bloom_strength;
+};
+
+struct GradeConstants {
+	glm::vec4 lift;
+	glm::vec4 gain;
+	glm::ivec2 size;
+	float contrast;
+	float saturation;
+};
+
+static uint32_t Groups(uint32_t pixels, uint32_t group_size)
+{
+	return (pixels + group_size - 1) / group_size;
+}
+
+// The part of an image that's drawn in, in uv
+static glm::vec2 AreaScale(FrameGraph * graph, string name)
+{
+	vk::Extent2D extent = graph->GetExtent(name);
+	vk::Rect2D area = graph->GetArea(name);
+	return glm::vec2(float(area.extent.width) / float(extent.width), float(area.extent.height) / float(extent.height));
+}
+
+PostProcessing::PostProcessing(VkRenderer * renderer) : renderer(renderer)
+{
+	renderer->CreateComputePipeline("Bloom Blur", ShaderStage(vk::ShaderStageFlagBits::eCompute, "uncompiled_shaders/blur.comp"));
+	renderer->CreateComputePipeline("Tonemap", ShaderStage(vk::ShaderStageFlagBits::eCompute, "uncompiled_shaders/tonemap.comp"));
+	renderer->CreateComputePipeline("Color Grade", ShaderStage(vk::ShaderStageFlagBits::eCompute, "uncompiled_shaders/grade.comp"));
+
+	const char * post_override = getenv("VK_POST_PROCESS");
+	SetEnabled(!(post_override && string(post_override) == "0"));
+}
+
+bool PostProcessing::SetEnabled(bool enable)
+{
+	if (enable && !renderer->SetSceneFormat(POST_FORMAT)){
+		enable = false;
+	}
+	if (!enable){
+		renderer->SetSceneFormat(vk::Format::eUndefined);
+	}
+	enabled = enable;
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Post processing %s", enabled ? "on" : "off");
+	return enabled;
+}
+
+string PostProcessing::AddPasses()
+{
+	// A recreated swapchain may have lost the scene target, the scene is in its format then
+	if (!enabled || renderer->GetSceneFormat() != POST_FORMAT){ return "Scene Color"; }
+
+	// The images are allocated at the scene's size, and drawn in the part the scene is drawn in (at the current scale)
+	FrameGraph * graph = renderer->frame_graph;
+	vk::Extent2D scene_extent = graph->GetExtent("Scene Color");
+	vk::Rect2D scene_area = graph->GetArea("Scene Color");
+	vk::Extent2D bloom_extent(max(scene_extent.width / 2, 1u), max(scene_extent.height / 2, 1u));
+	vk::Rect2D bloom_area(vk::Offset2D(), vk::Extent2D(max(scene_area.extent.width / 2, 1u), max(scene_area.extent.height / 2, 1u)));
+	graph->CreateImage("Bloom Across", POST_FORMAT, bloom_extent, bloom_area);
+	graph->CreateImage("Bloom", POST_FORMAT, bloom_extent, bloom_area);
+	graph->CreateImage("Tonemapped", POST_FORMAT, scene_extent, scene_area);
+	graph->CreateImage("Post Color", POST_FORMAT, scene_extent, scene_area);
+
+	AddBlurPass("Bloom Blur Across", "Bloom Across", "Scene Color", glm::ivec2(1, 0), settings.bloom_threshold);
+	AddBlurPass("Bloom Blur Down", "Bloom", "Bloom Across", glm::ivec2(0, 1), 0.0f);
+
+	PostSettings frame_settings = settings;
+	graph->AddPass("Tonemap",
+		[](FrameGraph::PassBuilder & pass){
+			pass.Read("Scene Color", FrameGraphUsage::SampledCompute);
+			pass.Read("Bloom", FrameGraphUsage::SampledCompute);
+			pass.Write("Tonemapped", FrameGraphUsage::StorageWrite, AttachmentPolicy{false}); // ..every pixel of the area is written
+		},
+		[this, graph, frame_settings](vk::CommandBuffer command_buffer){
+			vk::Extent2D size = graph->GetArea("Tonemapped").extent;
+			TonemapConstants constants;
+			constants.size = glm::ivec2(size.width, size.height);
+			constants.scene_scale = AreaScale(graph, "Scene Color");
+			constants.bloom_scale = AreaScale(graph, "Bloom");
+			constants.exposure = frame_settings.exposure;
+			constants.bloom_strength = frame_settings.bloom_strength;
+			renderer->Dispatch(command_buffer, "Tonemap",
+				{{0, graph->GetImageView("Scene Color")}, {1, graph->GetImageView("Bloom")}, {2, graph->GetImageView("Tonemapped")}},
+				Groups(size.width, PIXEL_GROUP), Groups(size.height, PIXEL_GROUP), 1, &constants, sizeof(constants));
+		});
+
+	graph->AddPass("Color Grade",
+		[](FrameGraph::PassBuilder & pass){
+			pass.Read("Tonemapped", FrameGraphUsage::StorageRead);
+			pass.Write("Post Color", FrameGraphUsage::StorageWrite, AttachmentPolicy{false});
+		},
+		[this, graph, frame_settings](vk::CommandBuffer command_buffer){
+			vk::Extent2D size = graph->GetArea("Post Color").extent;
+			GradeConstants constants;
+			constants.lift = glm::vec4(frame_settings.lift, 0.0f);
+			constants.gain = glm::vec4(frame_settings.gain, 1.0f);
+			constants.size = glm::ivec2(size.width, size.height);
+			constants.contrast = frame_settings.contrast;
+			constants.saturation = frame_settings.saturation;
+			renderer->Dispatch(command_buffer, "Color Grade",
+				{{0, graph->GetImageView("Tonemapped")}, {1, graph->GetImageView("Post Color")}},
+				Groups(size.width, PIXEL_GROUP), Groups(size.height, PIXEL_GROUP), 1, &constants, sizeof(constants));
+		});
+	return "Post Color";
+}
+
+void PostProcessing::AddBlurPass(string name, string destination, string source, glm::ivec2 direction, float threshold)
+{
+	FrameGraph * graph = renderer->frame_graph;
+	graph->AddPass(name,
+		[destination, source](FrameGraph::PassBuilder & pass){
+			pass.Read(source, FrameGraphUsage::SampledCompute);
+			pass.Write(destination, FrameGraphUsage::StorageWrite, AttachmentPolicy{false});
+		},
+		[this, graph, destination, source, direction, threshold](vk::CommandBuffer command_buffer){
+			vk::Extent2D size = graph->GetArea(destination).extent;
+			BlurConstants constants;
+			constants.size = glm::ivec2(size.width, size.height);
+			constants.source_scale = AreaScale(graph, source);
+			constants.direction = direction;
+			constants.threshold = threshold;
+			// ..a workgroup for every TILE pixels of every line
+			uint32_t line_length = direction.x ? size.width : size.height;
+			uint32_t lines = direction.x ? size.height : size.width;
+			renderer->Dispatch(command_buffer, "Bloom Blur",
+				{{0, graph->GetImageView(source)}, {1, graph->GetImageView(destination)}},
+				Groups(line_length, BLUR_TILE), lines, 1, &constants, sizeof(constants));
+		});
+}
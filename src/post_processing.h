@@ -0,0 +1,41 @@
+#pragma once
+#include "frame_graph.h"
+
+// Post Processing
+// The scene is drawn in 16 bit float, and compute passes (added to the frame graph after the scene's) take it to the
+// swapchain's range:
+//   - Bloom: what's brighter than bloom_threshold, at half resolution, blurred across and then down. Each workgroup
+//     reads a line of pixels into shared memory once, and takes every pixel's taps from there.
+//   - Tonemap: the scene plus bloom_strength of the bloom, scaled by exposure, through a filmic (ACES) curve
+//   - Grade: lift, gain, contrast and saturation
+// EndScene blits the result into the swapchain image, scaling it up at the same time. The images in between are frame
+// graph transients, the ones that are never alive together share memory. Needs the scene target (dynamic resolution),
+// without it the scene goes straight to the swapchain as before.
+struct PostSettings {
+	float exposure = 1.0f;
+	float bloom_threshold = 0.8f;
+	float bloom_strength = 0.5f;
+	glm::vec3 lift = glm::vec3(0.0f);
+	glm::vec3 gain = glm::vec3(1.0f);
+	float contrast = 1.0f;
+	float saturation = 1.0f;
+};
+
+class PostProcessing {
+	public:
+		PostSettings settings;
+
+		// ..Builds the compute pipelines and turns the chain on, VK_POST_PROCESS=0 starts with it off
+		PostProcessing(VkRenderer * renderer);
+
+		// ..Turns the chain on (drawing the scene in HDR) or off, returns whether it's on
+		bool SetEnabled(bool enable);
+		bool Enabled() const { return enabled; }
+		// ..Adds the chain's passes, after the scene's. Returns the image for EndScene to show ("Scene Color" while it's off)
+		string AddPasses();
+	private:
+		VkRenderer * renderer;
+		bool enabled = false;
+
+		void AddBlurPass(string name, string destination, string source, glm::ivec2 direction, float threshold);
+};
@@ -1,26 +1,134 @@
 #define VMA_IMPLEMENTATION
 #include "renderer.h"
+#include "frame_graph.h"
 #ifdef _WIN32
 #pragma comment(linker,"\"/manifestdependency:type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 #endif
 
-VkRenderer::VkRenderer(SDL_Window * window)
+// Cached framebuffers that go this many frames without being used are destroyed
+static const uint64_t FRAMEBUFFER_IDLE_FRAMES = 240;
+//Descriptor sets each pool holds (and descriptors of each type), a frame needing more gets another pool
+static const uint32_t DESCRIPTOR_POOL_SETS = 64;
+//What the scene is encoded in for an HDR10 swapchain (which is blitted into it), and hdr10.comp's workgroup size
+static const vk::Format HDR10_ENCODE_FORMAT = vk::Format::eR16G16B16A16Sfloat;
+static const uint32_t HDR10_ENCODE_GROUP = 8;
+
+//hdr10.comp's push constants
+struct HDR10Constants {
+	glm::ivec2 size;
+	glm::vec2 source_scale;
+	float paper_white;
+};
+
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+static bool HasStencil(vk::Format format)
+{
+	return format == vk::Format::eD16UnormS8Uint || format == vk::Format::eD24UnormS8Uint || format == vk::Format::eD32SfloatS8Uint ||
+		   format == vk::Format::eS8Uint;
+}
+#endif
+
+// Files kept between launches (the chosen device, the pipeline cache) live in the preferences directory
+static string PreferenceFile(string name)
+{
+	char * preference_path = SDL_GetPrefPath("", "Hello Vulkan++");
+	string path = string(preference_path ? preference_path : "") + name;
+	SDL_free(preference_path);
+	return path;
+}
+
+VkRenderer::VkRenderer()
+{
+	//The pipeline cache is read from disk while the driver starts up
+	pipeline_cache_file = PreferenceFile("pipeline_cache.bin");
+	auto cache_data = async(launch::async, [this]{
+		StartupTrace::Step step("Read Pipeline Cache");
+		ifstream file(pipeline_cache_file, ios::ate | ios::binary);
+		vector<char> data(file.is_open() ? size_t(file.tellg()) : 0);
+		file.seekg(0, ios::beg);
+		file.read(data.data(), data.size());
+		return data;
+	});
+
+	//Packed shaders (VkPackShaders.sh) sit next to the executable
+	{
+		StartupTrace::Step step("Map Shader Archive");
+		char * base_path = SDL_GetBasePath();
+		shader_archive.Open(string(base_path ? base_path : "") + "shaders.pak");
+		SDL_free(base_path);
+	}
+
+	{
+		StartupTrace::Step step("Create Instance");
+		InitInstance();
+	}
+	{
+		StartupTrace::Step step("Create Device");
+		CreateDeviceContext();
+	}
+	{
+		StartupTrace::Step step("Create Pipeline Cache");
+		vector<char> data = cache_data.get();
+		pipeline_cache = device->createPipelineCache(vk::PipelineCacheCreateInfo(vk::PipelineCacheCreateFlags(), data.size(), data.data())).value;
+		if (!pipeline_cache){
+			// ..a cache the driver doesn't like is just started over
+			pipeline_cache = device->createPipelineCache(vk::PipelineCacheCreateInfo()).value;
+		}
+	}
+}
+
+void VkRenderer::CreatePresentation(SDL_Window * window)
 {
 	GetSDLWindowInfo(window);
-	InitInstance();
-	CreateDeviceContext();
 	CreateSurface(window);
+
+	//Dynamic resolution aims for the display's refresh interval unless it's been given a budget
+	if (dynamic_resolution.frame_budget <= 0.0){
+		SDL_DisplayMode display_mode;
+		bool known = SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &display_mode) == 0 && display_mode.refresh_rate > 0;
+		dynamic_resolution.frame_budget = 1000.0 / (known ? display_mode.refresh_rate : 60);
+	}
+
+	//VK_PRESENT_POLICY=latency|power|throughput picks the policy the swapchain starts with
+	const char * policy_override = getenv("VK_PRESENT_POLICY");
+	if (policy_override && *policy_override){
+		string policy = policy_override;
+		if (policy == "latency"){ present_policy = PresentPolicy::LowestLatency; }
+		else if (policy == "power"){ present_policy = PresentPolicy::PowerSaving; }
+		else if (policy == "throughput"){ present_policy = PresentPolicy::TearFreeThroughput; }
+		else { SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Unknown VK_PRESENT_POLICY=%s, it's latency, power or throughput", policy_override); }
+	}
 	CreateSwapchain();
 	CreateSwapchainImages();
-	CreateDepthStencilImage();
+	SizeSceneTarget();
+	ChooseDepthFormat();
+
+	//VK_MSAA=1|2|4|8 sets the sample count the scene starts with (lowered to what the device can do)
+	const char * msaa_override = getenv("VK_MSAA");
+	if (msaa_override && *msaa_override){
+		int samples = atoi(msaa_override);
+		if (samples >= 1 && samples <= 64 && !(samples & (samples - 1))){ msaa_samples = SupportedSampleCount(vk::SampleCountFlagBits(samples)); }
+		else { SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Unknown VK_MSAA=%s, it's 1, 2, 4 or 8", msaa_override); }
+	}
+	multisampler.setRasterizationSamples(msaa_samples);
+
+	//Dynamic rendering is used when the device has it, VK_DYNAMIC_RENDERING=0 goes through render passes anyway
+	const char * dynamic_rendering_override = getenv("VK_DYNAMIC_RENDERING");
+	dynamic_rendering_active = capabilities.dynamic_rendering && !(dynamic_rendering_override && string(dynamic_rendering_override) == "0");
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Rendering with %s", dynamic_rendering_active ? "dynamic rendering" : "render passes");
 	CreateRenderpass();
-	CreateFramebuffers();
+	frame_graph = new FrameGraph(this);
 	
 	render_area.setExtent(vk::Extent2D(render_width, render_height));
 
 	CreateSynchronizations();
 }
 
+VkRenderer::VkRenderer(SDL_Window * window) : VkRenderer()
+{
+	CreatePresentation(window);
+}
+
 
 VkRenderer::~VkRenderer()
 {
@@ -28,17 +136,20 @@ VkRenderer::~VkRenderer()
 		DestroyDeviceCommandPool(&command_pool);
 	}
 	DestroyShaderModule();
-	DestroyPipelines();
+	SavePipelineCache();
 
 	graphics_queue.waitIdle();
 
-	DestroySynchronizations();
-
+	DestroyPipelines();
+	DestroyDescriptorPools();
+	delete frame_graph;
 	DestroyFramebuffers();
-	DestroyRenderpass();
-	DestroyDepthStencilImage();
 	DestroySwapchainImages();
 	DestroySwapchain();
+	DestroyRetiredObjects(true);
+	DestroyRenderPasses();
+
+	DestroySynchronizations();
 	DestroySurface();
 	DestroyDeviceContext();
 #ifdef VK_DEBUG
@@ -50,72 +161,167 @@ VkRenderer::~VkRenderer()
 
 void VkRenderer::GetSDLWindowInfo(SDL_Window * window) //Get the necessary information from the SDL2 window handle for Vulkan support.
 {
-	uint32_t extension_count = 0;
-	SDL_Vulkan_GetInstanceExtensions(window, &extension_count, NULL);
-	instance_extensions.resize(extension_count);
-	if (!SDL_Vulkan_GetInstanceExtensions(window, &extension_count, instance_extensions.data())){
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,"Vulkan Error", "No instance extensions for creating a window surface", NULL);
-		throw runtime_error("window creation error");
+	SDL_Vulkan_GetDrawableSize(window, &render_width, &render_height);
+}
+
+void VkRenderer::SavePipelineCache()
+{
+	if (!pipeline_cache){ return; }
+	auto data = device->getPipelineCacheData(pipeline_cache).value;
+	if (!data.empty()){
+		ofstream file(pipeline_cache_file, ios::binary);
+		file.write(reinterpret_cast<const char *>(data.data()), data.size());
 	}
-	device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	device->destroyPipelineCache(pipeline_cache);
+	pipeline_cache = nullptr;
+}
 
-	// if you can get the window extention info for vulkan, you can get the window rendering size.
-	SDL_Vulkan_GetDrawableSize(window, &render_width, &render_height);
+// Capability Tables
+// Every extension the renderer knows how to use. Required ones rule out a device (or the instance) when
+// they're missing, optional ones set their capability flag when enabled, and fall back as described otherwise.
+// Device dependencies are enabled along with the extension, an instance extension it needs is given by the
+// capability flag it sets (the instance table is negotiated first).
+// An extension is only listed once something in the renderer uses it.
+struct CapabilityEntry {
+	const char * name;
+	bool required;
+	bool RendererCapabilities::* capability;
+	const char * fallback;
+	const char * dependencies[4];
+	bool RendererCapabilities::* instance_capability;
+};
+
+static const CapabilityEntry instance_extension_table[] = {
+	{VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME, true, nullptr, "", {}},
+	{VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME, false, &RendererCapabilities::external_memory_capabilities,
+		"meshes are staged instead of imported, the device UUID isn't known", {}},
+	{VK_EXT_SWAPCHAIN_COLOR_SPACE_EXTENSION_NAME, false, &RendererCapabilities::swapchain_colorspace,
+		"the swapchain is always sRGB", {}},
+};
+
+static const CapabilityEntry device_extension_table[] = {
+	{VK_KHR_SWAPCHAIN_EXTENSION_NAME, true, nullptr, "", {}},
+	{VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME, true, nullptr, "", {}},
+	{VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME, true, nullptr, "", {}},
+	{VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME, false, &RendererCapabilities::external_memory_host,
+		"meshes are copied through a staging buffer", {VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME},
+		&RendererCapabilities::external_memory_capabilities},
+	{VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, false, &RendererCapabilities::memory_budget,
+		"the allocator estimates heap usage itself", {}},
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+	{VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME, false, &RendererCapabilities::dynamic_rendering,
+		"rendering goes through render passes", {VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME, VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+		 VK_KHR_MULTIVIEW_EXTENSION_NAME, VK_KHR_MAINTENANCE2_EXTENSION_NAME}},
+#endif
+#ifdef VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+	{VK_KHR_PRESENT_WAIT_EXTENSION_NAME, false, &RendererCapabilities::present_wait,
+		"frame latency is estimated from when rendering finishes", {VK_KHR_PRESENT_ID_EXTENSION_NAME}},
+#endif
+};
+
+// Core features. Only what the renderer actually relies on is enabled, everything else stays off
+// (robust buffer access in particular costs GPU time on every buffer access, so only debug builds get it).
+struct FeatureEntry {
+	const char * name;
+	vk::Bool32 vk::PhysicalDeviceFeatures::* feature;
+	bool required;
+	bool enable;
+};
+
+static const FeatureEntry feature_table[] = {
+#ifdef VK_DEBUG
+	{"robustBufferAccess", &vk::PhysicalDeviceFeatures::robustBufferAccess, false, true},
+#else
+	{"robustBufferAccess", &vk::PhysicalDeviceFeatures::robustBufferAccess, false, false},
+#endif
+};
+
+static set<string> SupportedDeviceExtensions(vk::PhysicalDevice gpu)
+{
+	set<string> names;
+	for (auto extension : gpu.enumerateDeviceExtensionProperties().value){
+		string name = extension.extensionName;
+		names.insert(name);
+	}
+	return names;
+}
+
+// ..An entry is usable if the device has it and all of its dependencies, and the instance has what it needs
+bool VkRenderer::DeviceExtensionUsable(const CapabilityEntry & entry, const set<string> & supported)
+{
+	if (!supported.count(entry.name)){ return false; }
+	if (entry.instance_capability && !(capabilities.*entry.instance_capability)){ return false; }
+	for (auto dependency : entry.dependencies){
+		if (dependency && !supported.count(dependency)){ return false; }
+	}
+	return true;
 }
 
 void VkRenderer::GetExtraInstanceExtensions() //Get the necessary extra instance extentions needed for the renderer.
 {
-	// everything below this is just for simple testing, VK_KHR_get_surface_capabilities2 isn't used.
-	vector<vk::ExtensionProperties> extensions = vk::enumerateInstanceExtensionProperties().value;
+	// Surface extensions don't depend on the window, so the instance can be made before (or while) it's created
+	uint32_t extension_count = 0;
+	SDL_Vulkan_GetInstanceExtensions(NULL, &extension_count, NULL);
+	vector<const char *> surface_extensions(extension_count);
+	if (!extension_count || !SDL_Vulkan_GetInstanceExtensions(NULL, &extension_count, surface_extensions.data())){
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,"Vulkan Error", "No instance extensions for creating a window surface", NULL);
+		throw runtime_error("window creation error");
+	}
+	instance_extensions.insert(instance_extensions.end(), surface_extensions.begin(), surface_extensions.end());
 
-	int extension_check = 0;
-	for (auto extension : extensions){
+	set<string> supported;
+	for (auto extension : vk::enumerateInstanceExtensionProperties().value){
 		string name = extension.extensionName;
+		supported.insert(name);
+	}
 
-		if (name == VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME){
-			extension_check += 1;
-			if (extension_check < required_i_extensions){
-				extension_check += 1;
-				instance_extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	for (auto & entry : instance_extension_table){
+		if (!supported.count(entry.name)){
+			if (entry.required){
+				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Missing instance extension %s", entry.name);
+				SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,"Vulkan Error", "Not all required extentions supported by the instance", NULL);
+				throw runtime_error("instance creation error");
 			}
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "%s unavailable, %s", entry.name, entry.fallback);
+			continue;
 		}
+		instance_extensions.push_back(entry.name);
+		if (entry.capability){ capabilities.*entry.capability = true; }
+	}
+}
 
+int VkRenderer::GetExtraDeviceExtensions(vk::PhysicalDevice * gpu) //Checks the device has every required extension and feature.
+{
+	auto supported = SupportedDeviceExtensions(*gpu);
+	for (auto & entry : device_extension_table){
+		if (entry.required && !DeviceExtensionUsable(entry, supported)){ return 0; }
 	}
-	if (extension_check != required_i_extensions){
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,"Vulkan Error", "Not all required extentions supported by the instance", NULL);
-		throw runtime_error("instance creation error");
+	auto features = gpu->getFeatures();
+	for (auto & entry : feature_table){
+		if (entry.required && !(features.*entry.feature)){ return 0; }
 	}
-
+	return 1;
 }
 
-int VkRenderer::GetExtraDeviceExtensions(vk::PhysicalDevice * gpu) //Get the necessary extra device extensions needed for the renderer.
+void VkRenderer::NegotiateDeviceExtensions()
 {
-	vector<vk::ExtensionProperties> extensions = gpu->enumerateDeviceExtensionProperties().value;
-	int extension_check = 0;
-	for (auto extension : extensions){
-		string extension_name = extension.extensionName;
-
-		if (extension_name == VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME){
-			extension_check += 1;
-			if (supported_d_extensions < required_d_extensions){
-				supported_d_extensions += 1;
-				device_extensions.push_back(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME);
-			}	
+	auto supported = SupportedDeviceExtensions(gpu);
+	for (auto & entry : device_extension_table){
+		if (!DeviceExtensionUsable(entry, supported)){
+			if (entry.capability){
+				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "%s unavailable, %s", entry.name, entry.fallback);
+			}
+			continue;
 		}
-
-		if (extension_name == VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME){
-			extension_check += 1;
-			if (supported_d_extensions < required_d_extensions){
-				supported_d_extensions += 1;
-				device_extensions.push_back(VK_KHR_DEDICATED_ALLOCATION_EXTENSION_NAME);
-			}	
+		for (auto dependency : entry.dependencies){
+			if (dependency && supported.count(dependency) &&
+				find_if(device_extensions.begin(), device_extensions.end(), [&](const char * name){ return string(name) == dependency; }) == device_extensions.end()){
+				device_extensions.push_back(dependency);
+			}
 		}
-
-	}
-	if ((extension_check == supported_d_extensions) && (supported_d_extensions == required_d_extensions)){
-		return 1;
+		device_extensions.push_back(entry.name);
+		if (entry.capability){ capabilities.*entry.capability = true; }
 	}
-	return 0;
 }
 
 void VkRenderer::InitInstance() //Initializes the Vulkan Instance
@@ -148,6 +354,9 @@ void VkRenderer::InitInstance() //Initializes the Vulkan Instance
 		throw "No instance created";
 	}
 
+	//Extension functions aren't exported by the loader, so they go through the dynamic dispatcher
+	dl.init(instance.get(), vkGetInstanceProcAddr);
+
 
 #ifdef VK_DEBUG
 	InitDebug();
@@ -161,8 +370,65 @@ void VkRenderer::DestroyInstance()
 	instance.release();
 }
 
-#define MBOX_CHOICES_YEA 1
-#define MBOX_CHOICES_NAY 0
+// Devices are ranked by type first (discrete > integrated > virtual > CPU), then by the size of their largest
+// device local heap, then by how many of the optional extensions and queue capabilities they have.
+uint64_t VkRenderer::ScoreDevice(vk::PhysicalDevice device_option)
+{
+	auto properties = device_option.getProperties();
+	auto memory = device_option.getMemoryProperties();
+
+	uint64_t type_rank = 0;
+	switch (properties.deviceType){
+		case vk::PhysicalDeviceType::eDiscreteGpu: type_rank = 3; break;
+		case vk::PhysicalDeviceType::eIntegratedGpu: type_rank = 2; break;
+		case vk::PhysicalDeviceType::eVirtualGpu: type_rank = 1; break;
+		default: type_rank = 0; break;
+	}
+
+	vk::DeviceSize local_memory = 0;
+	for (uint32_t i = 0; i < memory.memoryHeapCount; i++){
+		if (memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal){
+			local_memory = max(local_memory, memory.memoryHeaps[i].size);
+		}
+	}
+	uint64_t local_megabytes = min<uint64_t>(local_memory >> 20, (1ull << 40) - 1);
+
+	uint64_t extras = 0;
+	auto supported = SupportedDeviceExtensions(device_option);
+	for (auto & entry : device_extension_table){
+		if (!entry.required && DeviceExtensionUsable(entry, supported)){
+			extras++;
+		}
+	}
+	// ..separate transfer and compute families let uploads and compute work run alongside rendering
+	for (auto queue_family : device_option.getQueueFamilyProperties()){
+		if ((queue_family.queueFlags & vk::QueueFlagBits::eTransfer) && !(queue_family.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))){
+			extras++;
+		}
+		if ((queue_family.queueFlags & vk::QueueFlagBits::eCompute) && !(queue_family.queueFlags & vk::QueueFlagBits::eGraphics)){
+			extras++;
+		}
+	}
+
+	return (type_rank << 56) | (local_megabytes << 16) | min<uint64_t>(extras, 0xFFFF);
+}
+
+// The device UUID stays the same across launches and driver updates (vendor, device and name otherwise)
+string VkRenderer::DeviceUUID(vk::PhysicalDevice device_option)
+{
+	string uuid;
+	char hex[3];
+	if (capabilities.external_memory_capabilities){
+		auto id_properties = device_option.getProperties2KHR<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>(dl);
+		for (auto byte : id_properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID){
+			snprintf(hex, sizeof(hex), "%02x", unsigned(byte));
+			uuid += hex;
+		}
+		return uuid;
+	}
+	auto properties = device_option.getProperties();
+	return to_string(properties.vendorID) + "-" + to_string(properties.deviceID) + "-" + string(properties.deviceName);
+}
 
 void VkRenderer::CreateDeviceContext() //Creates the Vulkan Device Context.
 {
@@ -174,12 +440,13 @@ void VkRenderer::CreateDeviceContext() //Creates the Vulkan Device Context.
 		 " Couldn't find a Vulkan-enabled GPU.\n Make sure your GPU is supported by Vulkan, and if so make sure a Vulkan-enabled driver is installed for your GPU.\n To check if your GPU is supported, please visit https://vulkan.gpuinfo.org/", NULL);
 		throw "No device found";
 	}
-	int device_select = 0;
 
 	vector<vk::PhysicalDevice> selectable_devices = {};
+	vector<int> selectable_indices = {}; // position in physical_devices, which is what VK_DEVICE=<index> refers to
 	for (int i = 0; i < int(physical_devices.size()); i++){
 		if (GetExtraDeviceExtensions(&physical_devices[i])){
 			selectable_devices.push_back(physical_devices[i]);
+			selectable_indices.push_back(i);
 		}
 	}
 
@@ -190,51 +457,64 @@ void VkRenderer::CreateDeviceContext() //Creates the Vulkan Device Context.
 		throw "No device found";
 	}
 
-	if (selectable_devices.size() > 1)
+	//Device Selection
+	// ..VK_DEVICE (a device index, UUID or part of the name) wins, then the device picked last launch, then the best score.
+	// ..The choice is saved in the preferences directory, so it stays the same unless the device goes away.
+	string device_file = PreferenceFile("device.txt");
+	string saved_uuid;
 	{
-		bool choice_done = false;
-		int b_id = 0;
-		int current_index = 0;
-		while(!choice_done)
-		{
-			const SDL_MessageBoxButtonData buttons[] = {
-				{ SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, MBOX_CHOICES_YEA, "Use this" },
-				{ SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, MBOX_CHOICES_NAY, "Next" },
-			};
-			std::string prompt = "Do you want to use this device?\n\n";
-			VkPhysicalDeviceProperties current_gpu_properties = selectable_devices[current_index].getProperties();
-			prompt.append(current_gpu_properties.deviceName);
-#ifdef VK_DEBUG
-			prompt.append("\n\nDebug data\n    Device count  : ").append(std::to_string(physical_devices.size()));
-			prompt.append("\n    Current device: ").append(std::to_string(current_index));
-#endif
-			const SDL_MessageBoxData mbdata = {
-				SDL_MESSAGEBOX_INFORMATION,			/* .flags */
-				NULL,							/* .window */
-				"Vulkan device selector",				/* .title */
-				prompt.c_str(),					/* .message */
-				SDL_arraysize(buttons),				/* .numbuttons */
-				buttons,						/* .buttons */
-				nullptr						/* .colorScheme */
-			};
-
-			SDL_ShowMessageBox(&mbdata, &b_id);
-
-			if (b_id == MBOX_CHOICES_YEA)
-			{
-				choice_done = true;
-				device_select = current_index;
+		ifstream saved(device_file);
+		getline(saved, saved_uuid);
+	}
+	const char * device_override = getenv("VK_DEVICE");
+	int device_index = -1; // ..digits too many for an index are matched like a name or UUID instead
+	if (device_override && *device_override && string(device_override).find_first_not_of("0123456789") == string::npos){
+		try { device_index = stoi(device_override); }
+		catch (const out_of_range &) {}
+	}
+
+	int device_select = -1;
+	uint64_t best_score = 0;
+	for (int i = 0; i < int(selectable_devices.size()); i++){
+		string name = selectable_devices[i].getProperties().deviceName;
+		string uuid = DeviceUUID(selectable_devices[i]);
+		uint64_t score = ScoreDevice(selectable_devices[i]);
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Device %d: %s (%s), score %llu",
+			selectable_indices[i], name.c_str(), uuid.c_str(), (unsigned long long)score);
+
+		if (device_override && *device_override){
+			string option = device_override;
+			bool is_index = device_index >= 0;
+			if ((is_index && device_index == selectable_indices[i]) || option == uuid || (!is_index && name.find(option) != string::npos)){
+				device_select = i;
+				break;
 			}
-			else
-			{
-				current_index += 1;
-				if (current_index == int(selectable_devices.size()))
-				{
-					current_index = 0;
-				}
+			continue;
+		}
+		if (uuid == saved_uuid){
+			device_select = i;
+			break;
+		}
+		if (device_select < 0 || score > best_score){
+			device_select = i;
+			best_score = score;
+		}
+	}
+	if (device_select < 0){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "No usable device matches VK_DEVICE=%s, picking the best one", device_override);
+		for (int i = 0; i < int(selectable_devices.size()); i++){
+			uint64_t score = ScoreDevice(selectable_devices[i]);
+			if (device_select < 0 || score > best_score){
+				device_select = i;
+				best_score = score;
 			}
 		}
 	}
+	string selected_uuid = DeviceUUID(selectable_devices[device_select]);
+	if (selected_uuid != saved_uuid){
+		ofstream saved(device_file);
+		saved << selected_uuid << "\n";
+	}
 
 	gpu = selectable_devices[device_select];
 
@@ -252,7 +532,6 @@ void VkRenderer::CreateDeviceContext() //Creates the Vulkan Device Context.
 	printf("\n");
 	
 	//Get the GPU supported operations.
-	auto gpu_features = gpu.getFeatures();
 	auto gpu_qProperties = gpu.getQueueFamilyProperties();
 	auto gpu_qInfo = vector<vk::DeviceQueueCreateInfo>();
 	graphics_family_index = 0;
@@ -279,8 +558,57 @@ void VkRenderer::CreateDeviceContext() //Creates the Vulkan Device Context.
 		throw "GPU is crank!";
 	}
 
+	//Extensions and Features
+	NegotiateDeviceExtensions();
+	if (capabilities.external_memory_host){
+		auto host_properties = gpu.getProperties2KHR<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceExternalMemoryHostPropertiesEXT>(dl);
+		host_pointer_alignment = host_properties.get<vk::PhysicalDeviceExternalMemoryHostPropertiesEXT>().minImportedHostPointerAlignment;
+	}
+
+	auto supported_features = gpu.getFeatures();
+	for (auto & entry : feature_table){
+		if (entry.enable && supported_features.*entry.feature){
+			capabilities.features.*entry.feature = VK_TRUE;
+		}
+	}
+
+	// Extension features get queried through a chain of structs, one for each enabled extension
+	vk::PhysicalDeviceFeatures2 features;
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+	vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features;
+#endif
+#ifdef VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+	vk::PhysicalDevicePresentIdFeaturesKHR present_id_features;
+	vk::PhysicalDevicePresentWaitFeaturesKHR present_wait_features;
+#endif
+	auto chain = [&](bool enabled, auto & extension_features){
+		if (enabled){
+			extension_features.pNext = features.pNext;
+			features.pNext = &extension_features;
+		}
+	};
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+	chain(capabilities.dynamic_rendering, dynamic_rendering_features);
+#endif
+#ifdef VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+	chain(capabilities.present_wait, present_id_features);
+	chain(capabilities.present_wait, present_wait_features);
+#endif
+	gpu.getFeatures2KHR(&features, dl);
+
+	// ..then the same chain asks for just the features that get used (an extension without them stays unused)
+	features.features = capabilities.features;
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+	capabilities.dynamic_rendering = dynamic_rendering_features.dynamicRendering;
+#endif
+#ifdef VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+	capabilities.present_wait = present_id_features.presentId && present_wait_features.presentWait;
+	present_id_features.presentId = capabilities.present_wait;
+	present_wait_features.presentWait = capabilities.present_wait;
+#endif
+
 	//Logical Device Context
-	device = gpu.createDeviceUnique(vk::DeviceCreateInfo(
+	auto device_info = vk::DeviceCreateInfo(
 		vk::DeviceCreateFlags(),
 		gpu_qInfo.size(),
 		gpu_qInfo.data(),
@@ -288,17 +616,35 @@ void VkRenderer::CreateDeviceContext() //Creates the Vulkan Device Context.
 		NULL, 
 		device_extensions.size(),
 		device_extensions.data(),
-		&gpu_features
-	)).value;
+		nullptr // the core features are in the chain
+	);
+	device_info.pNext = &features;
+	device = gpu.createDeviceUnique(device_info).value;
+	if (!device){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Create Device Failed");
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Error!", "Couldn't create the logical device.", NULL);
+		throw "No device created";
+	}
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO,
+		"Capabilities: host import %d, memory budget %d, dynamic rendering %d, present wait %d",
+		capabilities.external_memory_host, capabilities.memory_budget, capabilities.dynamic_rendering, capabilities.present_wait);
 	graphics_queue = device->getQueue(graphics_family_index, 0);
 	queue_family_indices.push_back(graphics_family_index);
+	dl.init(instance.get(), vkGetInstanceProcAddr, device.get(), vkGetDeviceProcAddr);
+#ifndef VK_LOADER_DISPATCH
+	dldid.init(instance.get(), vkGetInstanceProcAddr, device.get(), vkGetDeviceProcAddr);
+#endif
 
 	//Create vulkan memory allocator.
+	auto allocator_flags = vma::AllocatorCreateFlags(vma::AllocatorCreateFlagBits::eKhrDedicatedAllocation);
+	if (capabilities.memory_budget){
+		allocator_flags |= vma::AllocatorCreateFlagBits::eExtMemoryBudget;
+	}
 	gpu_allocator = vma::createAllocator(vma::AllocatorCreateInfo(
-		vma::AllocatorCreateFlags(vma::AllocatorCreateFlagBits::eKhrDedicatedAllocation),
+		allocator_flags,
 		gpu, 
 		device.get()
-	)).value;
+	).setInstance(instance.get())).value;
 }
 
 void VkRenderer::DestroyDeviceContext()
@@ -323,14 +669,122 @@ void VkRenderer::CreateSurface(SDL_Window * window) //Creates a platform agnosti
 		render_height = surface_caps.currentExtent.height;
 	}
 
-	vector<vk::SurfaceFormatKHR> formats = gpu.getSurfaceFormatsKHR(surface).value;	
+	//VK_SURFACE_FORMAT=srgb|hdr10|scrgb picks the surface format policy the swapchain starts with
+	const char * format_override = getenv("VK_SURFACE_FORMAT");
+	if (format_override && *format_override){
+		string policy = format_override;
+		if (policy == "srgb"){ surface_format_policy = SurfaceFormatPolicy::SRGB; }
+		else if (policy == "hdr10"){ surface_format_policy = SurfaceFormatPolicy::HDR10; }
+		else if (policy == "scrgb"){ surface_format_policy = SurfaceFormatPolicy::ScRGB; }
+		else { SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Unknown VK_SURFACE_FORMAT=%s, it's srgb, hdr10 or scrgb", format_override); }
+	}
+}
 
-	if (formats[0].format == vk::Format::eUndefined) {
-		surface_format.format = vk::Format::eR8G8B8A8Unorm;
-		surface_format.colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+vk::SurfaceFormatKHR VkRenderer::ChooseSurfaceFormat(SurfaceFormatPolicy policy){
+	static const vector<vk::SurfaceFormatKHR> srgb_formats = {
+		{vk::Format::eB8G8R8A8Srgb, vk::ColorSpaceKHR::eSrgbNonlinear},
+		{vk::Format::eR8G8B8A8Srgb, vk::ColorSpaceKHR::eSrgbNonlinear},
+		{vk::Format::eA8B8G8R8SrgbPack32, vk::ColorSpaceKHR::eSrgbNonlinear},
+		// ..UNORM formats don't encode to sRGB on write, so they come after any that do
+		{vk::Format::eB8G8R8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear},
+		{vk::Format::eR8G8B8A8Unorm, vk::ColorSpaceKHR::eSrgbNonlinear},
+		{vk::Format::eA2B10G10R10UnormPack32, vk::ColorSpaceKHR::eSrgbNonlinear},
+		{vk::Format::eA2R10G10B10UnormPack32, vk::ColorSpaceKHR::eSrgbNonlinear},
+	};
+	static const vector<vk::SurfaceFormatKHR> hdr10_formats = {
+		{vk::Format::eA2B10G10R10UnormPack32, vk::ColorSpaceKHR::eHdr10St2084EXT},
+		{vk::Format::eA2R10G10B10UnormPack32, vk::ColorSpaceKHR::eHdr10St2084EXT},
+	};
+	// ..scRGB is linear with sRGB's primaries, the same as the scene, so it's blitted in as it is (HDR10 needs encoding)
+	static const vector<vk::SurfaceFormatKHR> scrgb_formats = {
+		{vk::Format::eR16G16B16A16Sfloat, vk::ColorSpaceKHR::eExtendedSrgbLinearEXT},
+	};
+
+	vector<vk::SurfaceFormatKHR> ranking;
+	if (capabilities.swapchain_colorspace && policy == SurfaceFormatPolicy::ScRGB){
+		ranking.insert(ranking.end(), scrgb_formats.begin(), scrgb_formats.end());
+	}
+	if (capabilities.swapchain_colorspace && policy != SurfaceFormatPolicy::SRGB){
+		ranking.insert(ranking.end(), hdr10_formats.begin(), hdr10_formats.end());
+	}
+	ranking.insert(ranking.end(), srgb_formats.begin(), srgb_formats.end());
+
+	// A single undefined format means the surface takes any format (in sRGB)
+	auto formats = gpu.getSurfaceFormatsKHR(surface).value;
+	bool any_format = formats.size() == 1 && formats[0].format == vk::Format::eUndefined;
+	auto drawable = [&](vk::Format format){
+		return bool(gpu.getFormatProperties(format).optimalTilingFeatures & vk::FormatFeatureFlagBits::eColorAttachment);
+	};
+	for (auto & candidate : ranking){
+		bool listed = any_format ? candidate.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear :
+								   find(formats.begin(), formats.end(), candidate) != formats.end();
+		// ..HDR10 is encoded on the way from the scene target to the swapchain, without one it would be shown as sRGB
+		bool encodable = candidate.colorSpace != vk::ColorSpaceKHR::eHdr10St2084EXT || SceneTargetSupported(candidate.format);
+		if (listed && drawable(candidate.format) && encodable){
+			return candidate;
+		}
+	}
+	// ..none of the ranked formats, so the first one listed that can be drawn into
+	for (auto & format : formats){
+		if (format.format != vk::Format::eUndefined && drawable(format.format)){
+			return format;
+		}
+	}
+	return formats[0];
+}
+
+void VkRenderer::SetSurfaceFormatPolicy(SurfaceFormatPolicy policy){
+	surface_format_policy = policy;
+	if (ChooseSurfaceFormat(policy) != surface_format){
+		RecreateSwapchain();
 	}
-	else { surface_format = formats[0]; }
-	
+}
+
+vk::SampleCountFlagBits VkRenderer::SupportedSampleCount(vk::SampleCountFlagBits samples){
+	//The color and depth attachments are both multisampled, so both have to take the count
+	uint32_t supported = gpu_properties.limits.framebufferColorSampleCounts & gpu_properties.limits.framebufferDepthSampleCounts;
+	uint32_t count = uint32_t(samples);
+	while (count > 1 && !(supported & count)){
+		count >>= 1;
+	}
+	return vk::SampleCountFlagBits(max(count, 1u));
+}
+
+void VkRenderer::SetSampleCount(vk::SampleCountFlagBits samples){
+	samples = SupportedSampleCount(samples);
+	if (samples == msaa_samples){ return; }
+	//The attachments are frame graph transients, so they follow on the next frame. Only the pipelines are rebuilt.
+	msaa_samples = samples;
+	multisampler.setRasterizationSamples(samples);
+	CreateRenderpass();
+	RebuildPipelines();
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "MSAA: %u samples", uint32_t(samples));
+}
+
+bool VkRenderer::SetSceneFormat(vk::Format format){
+	if (format != vk::Format::eUndefined){
+		auto needed = vk::FormatFeatureFlagBits::eColorAttachment | vk::FormatFeatureFlagBits::eBlitSrc |
+					  vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+		auto format_features = gpu.getFormatProperties(format).optimalTilingFeatures;
+		if (!scene_target_active || (format_features & needed) != needed){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Can't draw the scene in %s%s", vk::to_string(format).c_str(),
+				scene_target_active ? "" : " without the scene target");
+			return false;
+		}
+	}
+	//Like the sample count, the scene's images follow on the next frame, and only the pipelines are rebuilt
+	vk::Format old_format = GetSceneFormat();
+	scene_format = format;
+	if (GetSceneFormat() != old_format){
+		CreateRenderpass();
+		RebuildPipelines();
+	}
+	return true;
+}
+
+vk::Format VkRenderer::GetSceneFormat() const{
+	//...the swapchain's, when the scene is drawn straight into it
+	return (scene_format != vk::Format::eUndefined && scene_target_active) ? scene_format : surface_format.format;
 }
 
 void VkRenderer::DestroySurface(){
@@ -345,18 +799,27 @@ void VkRenderer::CreateSwapchain(){ //Create the Swapchain.
 			buffer_count = surface_caps.minImageCount + 1;}
 	}
 
-	auto present_modes = gpu.getSurfacePresentModesKHR(surface).value;
+	present_mode = ChoosePresentMode(present_policy);
+	surface_format = ChooseSurfaceFormat(surface_format_policy);
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Surface format: %s, %s",
+		vk::to_string(surface_format.format).c_str(), vk::to_string(surface_format.colorSpace).c_str());
+	swapchain_first_frame = frame_count + 1;
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Present mode: %s", vk::to_string(present_mode).c_str());
+
+	//The scaled scene gets blitted into the swapchain images
+	scene_target_active = SceneTargetSupported(surface_format.format);
+	vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eColorAttachment;
+	if (scene_target_active){
+		usage |= vk::ImageUsageFlagBits::eTransferDst;
+	}
 
-	if (!present_mode_set) { present_mode = present_modes[0]; }
-	present_mode_set = true;
-	
 	swapchain = device->createSwapchainKHR(vk::SwapchainCreateInfoKHR(
 		vk::SwapchainCreateFlagsKHR(),
 		surface, buffer_count, 
 		surface_format.format,
 		surface_format.colorSpace,
 		vk::Extent2D(render_width, render_height),
-		1, vk::ImageUsageFlagBits::eColorAttachment, 
+		1, usage,
 		vk::SharingMode::eExclusive,
 		queue_family_indices.size(), queue_family_indices.data(),
 		vk::SurfaceTransformFlagBitsKHR::eIdentity,
@@ -365,31 +828,60 @@ void VkRenderer::CreateSwapchain(){ //Create the Swapchain.
 	)).value;
 }
 
+vk::PresentModeKHR VkRenderer::ChoosePresentMode(PresentPolicy policy){
+	static const vector<vk::PresentModeKHR> rankings[] = {
+		{vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eFifoRelaxed, vk::PresentModeKHR::eFifo}, // LowestLatency
+		{vk::PresentModeKHR::eFifo, vk::PresentModeKHR::eFifoRelaxed},                                                              // PowerSaving
+		{vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eFifo, vk::PresentModeKHR::eFifoRelaxed},                                 // TearFreeThroughput
+	};
+	auto supported = gpu.getSurfacePresentModesKHR(surface).value;
+	for (auto mode : rankings[int(policy)]){
+		if (find(supported.begin(), supported.end(), mode) != supported.end()){
+			return mode;
+		}
+	}
+	return vk::PresentModeKHR::eFifo; // ..every surface supports it
+}
+
+void VkRenderer::SetPresentPolicy(PresentPolicy policy){
+	present_policy = policy;
+	if (ChoosePresentMode(policy) != present_mode){
+		RecreateSwapchain();
+	}
+}
+
 void VkRenderer::DestroySwapchain(){
-	device->destroySwapchainKHR(swapchain);
+	vk::SwapchainKHR retired_swapchain = swapchain;
+	Retire([this, retired_swapchain]{ device->destroySwapchainKHR(retired_swapchain); });
+	swapchain = nullptr;
 }
 
 void VkRenderer::RecreateSwapchain(){
+		//The frames in flight keep drawing into the old objects, they're destroyed once those frames finish
+		//Framebuffers go with the views they use, the render pass is kept if it still matches, and the frame graph
+		//makes new transients when the frames it's given change size
 		this->old_swapchain = this->swapchain;
-		DestroyFramebuffers();
-		DestroyRenderpass();
-		DestroyDepthStencilImage();
+		vk::Format old_format = GetSceneFormat();
 		DestroySwapchainImages();
 
 		CreateSwapchain();
 		CreateSwapchainImages();
-		CreateDepthStencilImage();
+		SizeSceneTarget();
 		CreateRenderpass();
-		CreateFramebuffers();
 
-		device->destroySwapchainKHR(this->old_swapchain);
+		vk::SwapchainKHR retired_swapchain = old_swapchain;
+		Retire([this, retired_swapchain]{ device->destroySwapchainKHR(retired_swapchain); });
 		old_swapchain = nullptr;
+
+		//Pipelines only work with render passes that have the same formats
+		if (GetSceneFormat() != old_format){
+			RebuildPipelines();
+		}
 }
 
 void VkRenderer::ResizeSwapchain(){
 	surface_caps = gpu.getSurfaceCapabilitiesKHR(surface).value;
 	if ((render_height != int(surface_caps.currentExtent.height)) || (render_width != int(surface_caps.currentExtent.width))) {
-		device->waitIdle();
 		render_height = (int)surface_caps.currentExtent.height;
 		render_width = (int)surface_caps.currentExtent.width;
 		RecreateSwapchain();
@@ -420,14 +912,18 @@ void VkRenderer::CreateSwapchainImages(){
 }
 
 void VkRenderer::DestroySwapchainImages(){
-	for (auto image : swapchain_buffer_view) {
-		device->destroyImageView(image);
-	}
+	vector<vk::ImageView> views = swapchain_buffer_view;
+	EvictFramebuffers(views);
+	Retire([this, views]{
+		for (auto image : views) {
+			device->destroyImageView(image);
+		}
+	});
 	swapchain_buffer_view.resize(0);
 }
 
 
-void VkRenderer::CreateDepthStencilImage(){ //Create the Depth and Stencil Buffer Attachments for Swapchain Rendering
+void VkRenderer::ChooseDepthFormat(){ //The depth buffer itself is a frame graph transient
 
 	//Check for the format of the Depth/Stencil Buffer
 	vector<vk::Format> depth_formats = {vk::Format::eD32SfloatS8Uint, vk::Format::eD32Sfloat, 
@@ -442,62 +938,42 @@ void VkRenderer::CreateDepthStencilImage(){ //Create the Depth and Stencil Buffe
 	}
 
 	//Check the Buffer Aspect
-	if (depth_buffer_format != vk::Format::eUndefined)
-		stencil_support = true;
-
-	tie(depth_stencil_buffer, depth_buffer_allocation) = gpu_allocator.createImage(vk::ImageCreateInfo(
-		vk::ImageCreateFlags(),vk::ImageType::e2D, depth_buffer_format,
-		vk::Extent3D(vk::Extent2D(render_width, render_height), 1), 1,
-		1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal, 
-		vk::ImageUsageFlagBits::eDepthStencilAttachment, 
-		vk::SharingMode::eExclusive, queue_family_indices.size(), 
-		queue_family_indices.data(),
-		vk::ImageLayout::eUndefined),
-		vma::AllocationCreateInfo(
-			vma::AllocationCreateFlags(vma::AllocationCreateFlagBits::eDedicatedMemory))
-	).value;
-
-	depth_stencil_buffer_view  = device->createImageView(
-		vk::ImageViewCreateInfo(
-			vk::ImageViewCreateFlags(), depth_stencil_buffer,
-			vk::ImageViewType::e2D, depth_buffer_format,
-			vk::ComponentMapping(),  //R,G,B,A: Identity Components
-			vk::ImageSubresourceRange(
-				vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil,
-				0, 1, 0, 1)
-		)).value;
-	
-}
-
-void VkRenderer::DestroyDepthStencilImage(){
-	device->destroyImageView(depth_stencil_buffer_view);
-	gpu_allocator.destroyImage(depth_stencil_buffer, depth_buffer_allocation);
+	stencil_support = depth_buffer_format == vk::Format::eD32SfloatS8Uint || depth_buffer_format == vk::Format::eD24UnormS8Uint ||
+					  depth_buffer_format == vk::Format::eD16UnormS8Uint;
 }
 
 void VkRenderer::CreateRenderpass() {
-	vector<vk::AttachmentDescription> attachment_descriptions = //Render pass attachment descriptions (currently for the color pass and depth pass)
+	//Dynamic rendering needs no render pass, pipelines are made for the formats they draw into
+	if (dynamic_rendering_active){
+		renderpass = nullptr;
+		return;
+	}
+
+	//Render pass attachment descriptions (currently for the color pass and depth pass). Load and store ops don't matter
+	//for compatibility, these match what the frame graph derives for the scene: cleared, with only the color kept.
+	vector<vk::AttachmentDescription> attachment_descriptions =
 		{
 			vk::AttachmentDescription( 
-				vk::AttachmentDescriptionFlags(), //DEPTH BUFFER ATTACHMENT
+				vk::AttachmentDescriptionFlags(), //DEPTH/STENCIL BUFFER ATTACHMENT
 				depth_buffer_format,			  //format
-				vk::SampleCountFlagBits::e1,	  //samples
-				vk::AttachmentLoadOp::eClear,	  //loadOp
-				vk::AttachmentStoreOp::eDontCare, //storeOp
-				vk::AttachmentLoadOp::eDontCare,  //depth loadOp
-				vk::AttachmentStoreOp::eStore,	  //depth storeOp
-				vk::ImageLayout::eUndefined,	  //initial/final image layout
+				msaa_samples,					  //samples
+				vk::AttachmentLoadOp::eClear,	  //depth loadOp
+				vk::AttachmentStoreOp::eDontCare, //depth storeOp
+				stencil_support ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eDontCare, //stencil loadOp
+				vk::AttachmentStoreOp::eDontCare, //stencil storeOp
+				vk::ImageLayout::eDepthStencilAttachmentOptimal, //initial/final image layout (the frame graph's barriers move it in and out)
 				vk::ImageLayout::eDepthStencilAttachmentOptimal),
 
 			vk::AttachmentDescription(
-				vk::AttachmentDescriptionFlags(), //STENCIL BUFFER ATTACHMENT
-				surface_format.format,			  //format
-				vk::SampleCountFlagBits::e1,	  //samples
+				vk::AttachmentDescriptionFlags(), //COLOR ATTACHMENT
+				GetSceneFormat(),				  //format
+				msaa_samples,					  //samples
 				vk::AttachmentLoadOp::eClear,	  //loadOp
 				vk::AttachmentStoreOp::eStore,	  //storeOp
 				vk::AttachmentLoadOp::eDontCare,  //stencil loadOp
 				vk::AttachmentStoreOp::eDontCare, //stencil storeOp
-				vk::ImageLayout::eUndefined,	  //initial image layout
-				vk::ImageLayout::ePresentSrcKHR   //final image layout
+				vk::ImageLayout::eColorAttachmentOptimal, //initial image layout
+				vk::ImageLayout::eColorAttachmentOptimal  //final image layout
 				),
 			//extra attachments
 			//~extra attachments
@@ -507,19 +983,31 @@ void VkRenderer::CreateRenderpass() {
 		vk::AttachmentReference(0, vk::ImageLayout::eDepthStencilAttachmentOptimal)
 	};
 
-	vector<vk::AttachmentReference> stencil_reference = {
+	vector<vk::AttachmentReference> color_reference = {
 		vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal) // synonymous with (in glsl): layout(location = 1) out vec4 FinalColor
 		//extra color attachments
 		//~extra color attachments
 	};
 
+	//With MSAA the color attachment resolves into a single sampled one (the swapchain image or the scene target)
+	vector<vk::AttachmentReference> resolve_reference = {
+		vk::AttachmentReference(2, vk::ImageLayout::eColorAttachmentOptimal)
+	};
+	if (msaa_samples != vk::SampleCountFlagBits::e1){
+		vk::AttachmentDescription resolve_attachment = attachment_descriptions[1];
+		resolve_attachment.samples = vk::SampleCountFlagBits::e1;
+		resolve_attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+		attachment_descriptions.push_back(resolve_attachment);
+	}
+
 	//subpasses used for stages that are part of the renderpass
 	vector<vk::SubpassDescription> subpasses = {
 		vk::SubpassDescription(
 			vk::SubpassDescriptionFlags(),
 			vk::PipelineBindPoint::eGraphics,
-			0, nullptr, stencil_reference.size(),
-			stencil_reference.data(), nullptr, 
+			0, nullptr, color_reference.size(),
+			color_reference.data(),
+			msaa_samples != vk::SampleCountFlagBits::e1 ? resolve_reference.data() : nullptr,
 			depth_reference.data(), 0, nullptr)
 
 		//extra subpasses
@@ -527,48 +1015,158 @@ void VkRenderer::CreateRenderpass() {
 	};
 
 	//Subpass dependecies (for extra control)
+	// ...none, the frame graph puts barriers around the passes
 	vector<vk::SubpassDependency> subpass_dependencies = {};
 
-	//The renderpass where rendering operations are performed
-	renderpass = device->createRenderPass(
-		vk::RenderPassCreateInfo(
-			vk::RenderPassCreateFlags(),
-			attachment_descriptions.size(),
-			attachment_descriptions.data(),
-			subpasses.size(),
-			subpasses.data(),
-			subpass_dependencies.size(),
-			subpass_dependencies.data()
-		)).value;
+	//Pipelines are built against this render pass. The frame graph makes the scene pass's own, which is compatible with it
+	//(the same attachment formats and sample counts, in the same order)
+	renderpass = GetRenderPass(attachment_descriptions, subpasses, subpass_dependencies);
 }
 
 
-void VkRenderer::DestroyRenderpass() {
-	device->destroyRenderPass(renderpass);
+void VkRenderer::DestroyRenderPasses() {
+	for (auto & pass : render_passes) {
+		device->destroyRenderPass(pass.second);
+	}
+	render_passes.clear();
 }
 
 
-void VkRenderer::CreateFramebuffers() {
-	frame_buffers.resize(buffer_count);
-	for (int i = 0; i < buffer_count; i++) {
-		vector<vk::ImageView> framebuffer_attachments =
-			{depth_stencil_buffer_view, swapchain_buffer_view[i]};
+static string AttachmentReferenceKey(const vk::AttachmentReference * references, uint32_t count) {
+	string key;
+	for (uint32_t i = 0; references && i < count; i++) {
+		key += to_string(references[i].attachment) + "/" + to_string(uint32_t(references[i].layout)) + ",";
+	}
+	return key + ";";
+}
+
+vk::RenderPass VkRenderer::GetRenderPass(const vector<vk::AttachmentDescription> & attachments, const vector<vk::SubpassDescription> & subpasses,
+										 const vector<vk::SubpassDependency> & dependencies) {
+	string key;
+	for (auto & attachment : attachments) {
+		key += to_string(uint32_t(attachment.flags)) + ":" + to_string(uint32_t(attachment.format)) + ":" + to_string(uint32_t(attachment.samples)) + ":" +
+			   to_string(uint32_t(attachment.loadOp)) + ":" + to_string(uint32_t(attachment.storeOp)) + ":" +
+			   to_string(uint32_t(attachment.stencilLoadOp)) + ":" + to_string(uint32_t(attachment.stencilStoreOp)) + ":" +
+			   to_string(uint32_t(attachment.initialLayout)) + ":" + to_string(uint32_t(attachment.finalLayout)) + ";";
+	}
+	key += "|";
+	for (auto & subpass : subpasses) {
+		key += to_string(uint32_t(subpass.flags)) + ":" + to_string(uint32_t(subpass.pipelineBindPoint)) + ":" +
+			   AttachmentReferenceKey(subpass.pInputAttachments, subpass.inputAttachmentCount) +
+			   AttachmentReferenceKey(subpass.pColorAttachments, subpass.colorAttachmentCount) +
+			   AttachmentReferenceKey(subpass.pResolveAttachments, subpass.colorAttachmentCount) +
+			   AttachmentReferenceKey(subpass.pDepthStencilAttachment, 1);
+		for (uint32_t i = 0; i < subpass.preserveAttachmentCount; i++) {
+			key += to_string(subpass.pPreserveAttachments[i]) + ",";
+		}
+		key += "|";
+	}
+	for (auto & dependency : dependencies) {
+		key += to_string(dependency.srcSubpass) + ":" + to_string(dependency.dstSubpass) + ":" +
+			   to_string(uint32_t(dependency.srcStageMask)) + ":" + to_string(uint32_t(dependency.dstStageMask)) + ":" +
+			   to_string(uint32_t(dependency.srcAccessMask)) + ":" + to_string(uint32_t(dependency.dstAccessMask)) + ":" +
+			   to_string(uint32_t(dependency.dependencyFlags)) + ";";
+	}
+
+	if (!render_passes.count(key)) {
+		render_passes[key] = device->createRenderPass(
+			vk::RenderPassCreateInfo(
+				vk::RenderPassCreateFlags(),
+				attachments.size(),
+				attachments.data(),
+				subpasses.size(),
+				subpasses.data(),
+				dependencies.size(),
+				dependencies.data()
+			)).value;
+	}
+	return render_passes[key];
+}
+
+vk::Framebuffer VkRenderer::GetFramebuffer(vk::RenderPass pass, const vector<vk::ImageView> & views, vk::Extent2D extent) {
+	string key = to_string(uint64_t(VkRenderPass(pass))) + ":" + to_string(extent.width) + "x" + to_string(extent.height) + ":";
+	for (auto view : views) {
+		key += to_string(uint64_t(VkImageView(view))) + ",";
+	}
 
-		frame_buffers[i] = device->createFramebuffer(
+	auto cached = framebuffers.find(key);
+	if (cached == framebuffers.end()) {
+		vk::Framebuffer framebuffer = device->createFramebuffer(
 			vk::FramebufferCreateInfo(
 				vk::FramebufferCreateFlags(),
-				renderpass, framebuffer_attachments.size(),
-				framebuffer_attachments.data(),
-				render_width, render_height, 1)
+				pass, views.size(), views.data(),
+				extent.width, extent.height, 1)
 		).value;
+		cached = framebuffers.insert({key, CachedFramebuffer{framebuffer, views, 0}}).first;
 	}
+	cached->second.last_used = frame_count + 1; // ..the frame being recorded
+	return cached->second.framebuffer;
+}
 
+void VkRenderer::EvictFramebuffers(const vector<vk::ImageView> & views) {
+	for (auto cached = framebuffers.begin(); cached != framebuffers.end();) {
+		bool uses_view = false;
+		for (auto view : views) {
+			uses_view = uses_view || find(cached->second.views.begin(), cached->second.views.end(), view) != cached->second.views.end();
+		}
+		if (!uses_view) {
+			cached++;
+			continue;
+		}
+		vk::Framebuffer framebuffer = cached->second.framebuffer;
+		Retire([this, framebuffer]{ device->destroyFramebuffer(framebuffer); });
+		cached = framebuffers.erase(cached);
+	}
+}
+
+void VkRenderer::EvictIdleFramebuffers() {
+	for (auto cached = framebuffers.begin(); cached != framebuffers.end();) {
+		if (cached->second.last_used + FRAMEBUFFER_IDLE_FRAMES > frame_count) {
+			cached++;
+			continue;
+		}
+		vk::Framebuffer framebuffer = cached->second.framebuffer;
+		Retire([this, framebuffer]{ device->destroyFramebuffer(framebuffer); });
+		cached = framebuffers.erase(cached);
+	}
+}
+
+
+bool VkRenderer::SceneTargetSupported(vk::Format format) {
+	if (!dynamic_resolution.enabled){ return false; }
+	auto needed = vk::FormatFeatureFlagBits::eColorAttachment | vk::FormatFeatureFlagBits::eBlitSrc |
+				  vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+	auto format_features = gpu.getFormatProperties(format).optimalTilingFeatures;
+	return (format_features & needed) == needed && (surface_caps.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst);
 }
 
+void VkRenderer::SizeSceneTarget() { //The target itself is a frame graph transient, made at this size
+	auto & resolution = dynamic_resolution;
+	if (!scene_target_active){
+		scene_extent = vk::Extent2D(render_width, render_height);
+		resolution.scale = 1.0f;
+		return;
+	}
+	resolution.max_scale = max(resolution.max_scale, resolution.min_scale);
+	resolution.scale = min(max(resolution.scale, resolution.min_scale), resolution.max_scale);
+	scene_extent = vk::Extent2D(
+		max(uint32_t(ceil(render_width * resolution.max_scale)), 1u),
+		max(uint32_t(ceil(render_height * resolution.max_scale)), 1u));
+}
+
+vk::Extent2D VkRenderer::ScaledExtent() {
+	if (!scene_target_active){ return vk::Extent2D(render_width, render_height); }
+	return vk::Extent2D(
+		min(max(uint32_t(render_width * dynamic_resolution.scale + 0.5f), 1u), scene_extent.width),
+		min(max(uint32_t(render_height * dynamic_resolution.scale + 0.5f), 1u), scene_extent.height));
+}
 
 void VkRenderer::DestroyFramebuffers() {
-	for (auto buffer : frame_buffers)
-		device->destroyFramebuffer(buffer);
+	for (auto & cached : framebuffers) {
+		vk::Framebuffer framebuffer = cached.second.framebuffer;
+		Retire([this, framebuffer]{ device->destroyFramebuffer(framebuffer); });
+	}
+	framebuffers.clear();
 }
 
 vk::CommandPool VkRenderer::CreateDeviceCommandPool(uint32_t index, vk::CommandPoolCreateFlagBits flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer){
@@ -602,9 +1200,19 @@ void VkRenderer::CreateSynchronizations() {
 	present_semaphore = device->createSemaphore(vk::SemaphoreCreateInfo()).value;
 	render_semaphore = device->createSemaphore(vk::SemaphoreCreateInfo()).value;
 	wait_fences.resize(buffer_count);
+	fence_frames.resize(buffer_count, 0);
 	for (int i=0; i < buffer_count; i++){
 		wait_fences[i] = device->createFence(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled)).value;
 	}
+
+	//GPU frame times, for dynamic resolution
+	uint32_t timestamp_bits = gpu.getQueueFamilyProperties()[graphics_family_index].timestampValidBits;
+	timestamp_mask = (timestamp_bits >= 64) ? ~uint64_t(0) : (uint64_t(1) << timestamp_bits) - 1;
+	if (timestamp_mask){
+		timestamp_queries = device->createQueryPool(vk::QueryPoolCreateInfo(
+			vk::QueryPoolCreateFlags(), vk::QueryType::eTimestamp, 2 * buffer_count)).value;
+	}
+	timestamps_written.assign(buffer_count, false);
 }
 
 
@@ -612,22 +1220,25 @@ void VkRenderer::DestroySynchronizations() {
 	for (auto fence: wait_fences)
 		device->destroyFence(fence);
 	device->destroySemaphore(render_semaphore);
+	if (timestamp_queries){
+		device->destroyQueryPool(timestamp_queries);
+	}
 	device->destroySemaphore(present_semaphore);
 }
 
 //_______________________________ FUNCTIONS RELATED TO RENDERING _____________________________________________
 int VkRenderer::AcquireNextBuffer(uint32_t &buf_num){
-	vk::ResultValue<uint32_t> result = device->acquireNextImageKHR(swapchain, UINT64_MAX, present_semaphore, nullptr);
+	vk::ResultValue<uint32_t> result = device->acquireNextImageKHR(swapchain, UINT64_MAX, present_semaphore, nullptr, dldid);
 	switch (result.result){
 		case vk::Result::eSuccess:
 		case vk::Result::eSuboptimalKHR:			
 			buf_num = result.value;
-			device->waitForFences(1, &wait_fences[buf_num], VK_TRUE, UINT64_MAX);
-			device->resetFences(1, &wait_fences[buf_num]);
+			device->waitForFences(1, &wait_fences[buf_num], VK_TRUE, UINT64_MAX, dldid);
+			device->resetFences(1, &wait_fences[buf_num], dldid);
+			ReadFrameTime(buf_num);
 			return 1;
 			break;
 		case vk::Result::eErrorOutOfDateKHR:
-			device->waitIdle();
 			RecreateSwapchain();
 			break;
 		case vk::Result::eTimeout:
@@ -639,33 +1250,713 @@ int VkRenderer::AcquireNextBuffer(uint32_t &buf_num){
 
 
 void VkRenderer::BeginRenderPresent(uint32_t &buf_num, vector<vk::CommandBuffer> buffers) {
-	vk::PipelineStageFlags pipeline_flags = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+	//Only what touches the swapchain image waits for it: the scene drawn into it, or just the blit when the scene has its own target
+	vk::PipelineStageFlags pipeline_flags = scene_target_active ? vk::PipelineStageFlagBits::eTransfer : vk::PipelineStageFlagBits::eColorAttachmentOutput;
 	auto submit_info = vk::SubmitInfo(1, &present_semaphore, &pipeline_flags, 1, &buffers[buf_num], 1, &render_semaphore);
 
 	//Submitting the command buffer to the graphics queue begins the rendering process for those set of commands
-	graphics_queue.submit(submit_info, wait_fences[buf_num]);
+	graphics_queue.submit(submit_info, wait_fences[buf_num], dldid);
+	frame_count++;
+	fence_frames[buf_num] = frame_count;
 
 	//presentKHR presents from the graphics queue, the finished swapchain that has been rendered to.
-	
-	result = graphics_queue.presentKHR(
-		vk::PresentInfoKHR(
+	auto present_info = vk::PresentInfoKHR(
 		1,
 		&render_semaphore,
 		1,
 		&swapchain,
 		&buf_num,
-		nullptr)
-	);
+		nullptr);
+#ifdef VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+	//...tagged with the frame number, so WaitForFrame can wait for it to be shown
+	uint64_t present_id = frame_count;
+	auto present_id_info = vk::PresentIdKHR(1, &present_id);
+	if (capabilities.present_wait){
+		present_info.pNext = &present_id_info;
+	}
+#endif
+	result = graphics_queue.presentKHR(present_info, dldid);
 
 	if (result == vk::Result::eSuboptimalKHR || result == vk::Result::eErrorOutOfDateKHR || resize_swapchain){
 		resize_swapchain = false;
 		ResizeSwapchain();
 	}	
+
+	if (frame_count % FRAMEBUFFER_IDLE_FRAMES == 0){
+		EvictIdleFramebuffers();
+	}
+	if (!retired_objects.empty()){
+		DestroyRetiredObjects();
+	}
 }
 
+void VkRenderer::BeginScene(vk::CommandBuffer command_buffer, uint32_t buf_num) {
+	command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit), dldid);
+	//The buffer's last frame is done (AcquireNextBuffer waited on it), so are the descriptor sets it dispatched with
+	current_buffer = buf_num;
+	if (descriptor_pools.size() <= buf_num){
+		descriptor_pools.resize(buf_num + 1);
+	}
+	for (auto pool : descriptor_pools[buf_num]){
+		device->resetDescriptorPool(pool, vk::DescriptorPoolResetFlags(), dldid);
+	}
+	if (timestamp_mask){
+		command_buffer.resetQueryPool(timestamp_queries, 2 * buf_num, 2, dldid);
+		command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestamp_queries, 2 * buf_num, dldid);
+	}
+
+	//The frame's resources: the swapchain image (the acquire semaphore is waited on before it's drawn into or blitted to),
+	//and the scene drawn into it, or into its own target at the current scale
+	render_area = vk::Rect2D(vk::Offset2D(), ScaledExtent());
+	FrameGraph::ImportedImage backbuffer;
+	backbuffer.image = swapchain_buffers[buf_num];
+	backbuffer.view = swapchain_buffer_view[buf_num];
+	backbuffer.format = surface_format.format;
+	backbuffer.extent = vk::Extent2D(render_width, render_height);
+	backbuffer.initial_stages = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eTransfer;
+	backbuffer.final_layout = vk::ImageLayout::ePresentSrcKHR;
+
+	frame_graph->Reset();
+	frame_graph->CreateImage("Depth", depth_buffer_format, scene_extent, render_area, msaa_samples);
+	if (msaa_samples != vk::SampleCountFlagBits::e1){
+		frame_graph->CreateImage("Scene Color MS", GetSceneFormat(), scene_extent, render_area, msaa_samples);
+	}
+	if (scene_target_active){
+		frame_graph->ImportImage("Backbuffer", backbuffer);
+		frame_graph->CreateImage("Scene Color", GetSceneFormat(), scene_extent, render_area);
+	}
+	else {
+		frame_graph->ImportImage("Scene Color", backbuffer);
+	}
+
+	//The viewports and scissors are given for the full window, and drawn at the scene's scale
+	float scale_x = float(render_area.extent.width) / float(render_width);
+	float scale_y = float(render_area.extent.height) / float(render_height);
+	if (!viewports.empty()){
+		vector<vk::Viewport> scaled_viewports = viewports;
+		for (auto & viewport : scaled_viewports){
+			viewport.x *= scale_x;
+			viewport.y *= scale_y;
+			viewport.width *= scale_x;
+			viewport.height *= scale_y;
+		}
+		command_buffer.setViewport(0, scaled_viewports, dldid);
+	}
+	if (!scissors.empty()){
+		vector<vk::Rect2D> scaled_scissors = scissors;
+		for (auto & scissor : scaled_scissors){
+			scissor.offset.x = int32_t(scissor.offset.x * scale_x);
+			scissor.offset.y = int32_t(scissor.offset.y * scale_y);
+			scissor.extent.width = uint32_t(ceil(scissor.extent.width * scale_x));
+			scissor.extent.height = uint32_t(ceil(scissor.extent.height * scale_y));
+		}
+		command_buffer.setScissor(0, scaled_scissors, dldid);
+	}
+}
+
+void VkRenderer::EndScene(vk::CommandBuffer command_buffer, uint32_t buf_num, string source) {
+	//HDR10 swapchains take Rec. 2020 through the PQ curve, which the blit can't do, so the (linear) scene is encoded first
+	if (scene_target_active && surface_format.colorSpace == vk::ColorSpaceKHR::eHdr10St2084EXT){
+		if (!pipeline_infos.count("HDR10 Encode")){
+			CreateComputePipeline("HDR10 Encode", ShaderStage(vk::ShaderStageFlagBits::eCompute, "uncompiled_shaders/hdr10.comp"));
+		}
+		frame_graph->CreateImage("HDR10 Color", HDR10_ENCODE_FORMAT, scene_extent, frame_graph->GetArea(source));
+		frame_graph->AddPass("HDR10 Encode",
+			[source](FrameGraph::PassBuilder & pass){
+				pass.Read(source, FrameGraphUsage::SampledCompute);
+				pass.Write("HDR10 Color", FrameGraphUsage::StorageWrite, AttachmentPolicy{false}); // ..every pixel of the area is written
+			},
+			[this, source](vk::CommandBuffer command_buffer){
+				vk::Extent2D source_extent = frame_graph->GetExtent(source);
+				vk::Extent2D size = frame_graph->GetArea("HDR10 Color").extent;
+				HDR10Constants constants;
+				constants.size = glm::ivec2(size.width, size.height);
+				constants.source_scale = glm::vec2(float(size.width) / float(source_extent.width), float(size.height) / float(source_extent.height));
+				constants.paper_white = hdr10_paper_white;
+				Dispatch(command_buffer, "HDR10 Encode", {{0, frame_graph->GetImageView(source)}, {1, frame_graph->GetImageView("HDR10 Color")}},
+					(size.width + HDR10_ENCODE_GROUP - 1) / HDR10_ENCODE_GROUP, (size.height + HDR10_ENCODE_GROUP - 1) / HDR10_ENCODE_GROUP, 1,
+					&constants, sizeof(constants));
+			});
+		source = "HDR10 Color";
+	}
+	if (scene_target_active){
+		frame_graph->AddPass("Upscale",
+			[source](FrameGraph::PassBuilder & pass){
+				pass.Read(source, FrameGraphUsage::TransferSrc);
+				pass.Write("Backbuffer", FrameGraphUsage::TransferDst, AttachmentPolicy{false}); // ..the blit covers all of it
+			},
+			[this, source](vk::CommandBuffer command_buffer){
+				auto color_layers = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+				vk::Rect2D source_area = frame_graph->GetArea(source);
+				vk::ImageBlit blit;
+				blit.srcSubresource = color_layers;
+				blit.srcOffsets[0] = vk::Offset3D(source_area.offset.x, source_area.offset.y, 0);
+				blit.srcOffsets[1] = vk::Offset3D(source_area.offset.x + int32_t(source_area.extent.width),
+												  source_area.offset.y + int32_t(source_area.extent.height), 1);
+				blit.dstSubresource = color_layers;
+				blit.dstOffsets[1] = vk::Offset3D(render_width, render_height, 1);
+				command_buffer.blitImage(frame_graph->GetImage(source), vk::ImageLayout::eTransferSrcOptimal,
+					frame_graph->GetImage("Backbuffer"), vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eLinear, dldid);
+			},
+			[this, buf_num](vk::CommandBuffer command_buffer){
+				//The frame is timed up to here: the blit waits for the swapchain image, so after it the time would include the wait to present
+				if (timestamp_mask){
+					command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_queries, 2 * buf_num + 1, dldid);
+					timestamps_written[buf_num] = true;
+				}
+			});
+	}
+	frame_graph->Execute(command_buffer);
+
+	//Without a scene target everything is drawn into the swapchain image, so there's nothing to time before the wait
+	if (timestamp_mask && !scene_target_active){
+		command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestamp_queries, 2 * buf_num + 1, dldid);
+		timestamps_written[buf_num] = true;
+	}
+	command_buffer.end(dldid);
+}
+
+void VkRenderer::ReadFrameTime(uint32_t buf_num) {
+	if (!timestamp_mask || !timestamps_written[buf_num]){ return; }
+	uint64_t timestamps[2];
+	if (device->getQueryPoolResults(timestamp_queries, 2 * buf_num, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+									vk::QueryResultFlagBits::e64, dldid) != vk::Result::eSuccess){ return; }
+	double gpu_ms = double((timestamps[1] - timestamps[0]) & timestamp_mask) * gpu_properties.limits.timestampPeriod / 1000000.0;
+
+	auto & resolution = dynamic_resolution;
+	resolution.gpu_time = (resolution.gpu_time > 0.0) ? resolution.gpu_time * 0.7 + gpu_ms * 0.3 : gpu_ms;
+	if (!scene_target_active || resolution.gpu_time <= 0.0){ return; }
+
+	// The scale only moves every few frames, so frames drawn at the last scale are measured before it moves again.
+	// Pixels go with the square of the scale, so it moves by the square root of how far the time is from the budget:
+	// down quickly when over, back up slowly when under.
+	if (scale_frames < 8){
+		scale_frames++;
+		return;
+	}
+	if (resolution.gpu_time > resolution.frame_budget * (1.0 + resolution.hysteresis) ||
+		resolution.gpu_time < resolution.frame_budget * (1.0 - resolution.hysteresis)){
+		float step = float(sqrt(resolution.frame_budget / resolution.gpu_time));
+		step = min(max(step, 0.8f), 1.05f);
+		resolution.scale = min(max(resolution.scale * step, resolution.min_scale), resolution.max_scale);
+		scale_frames = 0;
+	}
+}
+
+bool VkRenderer::WaitForFrame(uint64_t frame, uint64_t timeout, bool * presented){
+	if (presented){ *presented = false; }
+	if (frame > frame_count){ return false; }
+#ifdef VK_KHR_PRESENT_WAIT_EXTENSION_NAME
+	if (capabilities.present_wait && frame >= swapchain_first_frame){
+		vk::Result wait_result = device->waitForPresentKHR(swapchain, frame, timeout, dldid);
+		if (wait_result == vk::Result::eSuccess || wait_result == vk::Result::eSuboptimalKHR){
+			if (presented){ *presented = true; }
+			return true;
+		}
+		if (wait_result == vk::Result::eTimeout){ return false; }
+		// ..the present failed (out of date), so only its rendering can be waited on
+	}
+#endif
+	vector<vk::Fence> fences;
+	for (int i = 0; i < int(wait_fences.size()); i++){
+		if (fence_frames[i] && fence_frames[i] <= frame){ fences.push_back(wait_fences[i]); }
+	}
+	if (fences.empty()){ return true; }
+	return device->waitForFences(fences, VK_TRUE, timeout, dldid) == vk::Result::eSuccess;
+}
+
+bool VkRenderer::FrameRetired(uint64_t frame){
+	if (frame > frame_count){ return false; } // ..not even submitted yet
+	// Fences are waited on before they're reused, so a frame is done once every fence last submitted at or before it has signaled
+	for (int i = 0; i < int(wait_fences.size()); i++){
+		if (fence_frames[i] <= frame && device->getFenceStatus(wait_fences[i], dldid) != vk::Result::eSuccess){
+			return false;
+		}
+	}
+	return true;
+}
+
+
+SpecializationConstants & SpecializationConstants::Store(uint32_t constant_id, Type type, const void * value, size_t size){
+	Value & stored = values[constant_id];
+	stored.type = type;
+	stored.bits = 0;
+	memcpy(&stored.bits, value, size);
+	return *this;
+}
+
+SpecializationConstants & SpecializationConstants::Set(uint32_t constant_id, bool value){
+	VkBool32 boolean = value ? VK_TRUE : VK_FALSE;
+	return Store(constant_id, Type::Bool, &boolean, sizeof(boolean));
+}
+SpecializationConstants & SpecializationConstants::Set(uint32_t constant_id, int32_t value){ return Store(constant_id, Type::Int, &value, sizeof(value)); }
+SpecializationConstants & SpecializationConstants::Set(uint32_t constant_id, uint32_t value){ return Store(constant_id, Type::Uint, &value, sizeof(value)); }
+SpecializationConstants & SpecializationConstants::Set(uint32_t constant_id, float value){ return Store(constant_id, Type::Float, &value, sizeof(value)); }
+SpecializationConstants & SpecializationConstants::Set(uint32_t constant_id, double value){ return Store(constant_id, Type::Double, &value, sizeof(value)); }
+
+void SpecializationConstants::Merge(const SpecializationConstants & other){
+	for (auto & value : other.values){
+		values[value.first] = value.second;
+	}
+}
+
+string SpecializationConstants::Key() const{
+	string key;
+	char entry[48];
+	for (auto & value : values){
+		snprintf(entry, sizeof(entry), "%u:%u:%llx;", value.first, unsigned(value.second.type), (unsigned long long)value.second.bits);
+		key += entry;
+	}
+	return key;
+}
+
+vk::SpecializationInfo SpecializationConstants::Info(vector<vk::SpecializationMapEntry> & entries, vector<uint8_t> & data) const{
+	entries.clear();
+	data.clear();
+	for (auto & value : values){
+		size_t size = (value.second.type == Type::Double) ? 8 : 4;
+		entries.push_back(vk::SpecializationMapEntry(value.first, uint32_t(data.size()), size));
+		data.insert(data.end(), reinterpret_cast<const uint8_t *>(&value.second.bits), reinterpret_cast<const uint8_t *>(&value.second.bits) + size);
+	}
+	return vk::SpecializationInfo(entries.size(), entries.data(), data.size(), data.data());
+}
+
+vk::PipelineLayout VkRenderer::GetPipelineLayout(const GraphicsPipelineInfo & info, vector<vk::DescriptorSetLayout> * set_layouts_out){
+	if (info.layout){ return info.layout; }
+
+	// Merge what every stage declares, a binding used by several stages gets all of their stage flags
+	map<uint32_t, map<uint32_t, vk::DescriptorSetLayoutBinding>> sets;
+	vk::ShaderStageFlags push_constant_stages;
+	uint32_t push_constant_size = 0;
+	for (auto & shader : info.shaders){
+		if (!shader_reflections.count(shader.file)){
+			LoadShaderModule(shader.file);
+			DestroyShaderModule(shader.file);
+		}
+		auto & reflection = shader_reflections[shader.file];
+		for (auto & set : reflection.descriptor_sets){
+			for (auto & binding : set.second){
+				auto & merged = sets[set.first][binding.binding];
+				if (merged.stageFlags && merged.descriptorType != binding.descriptorType){
+					ShaderError("Shaders disagree on the type of descriptor set " + to_string(set.first) + ", binding " + to_string(binding.binding), shader.file);
+					throw runtime_error("mismatched descriptor types!");
+				}
+				vk::ShaderStageFlags stages = merged.stageFlags | shader.stage;
+				merged = binding;
+				merged.stageFlags = stages;
+				merged.descriptorCount = max(merged.descriptorCount, binding.descriptorCount);
+			}
+		}
+		if (reflection.push_constant_size){
+			push_constant_stages |= shader.stage;
+			push_constant_size = max(push_constant_size, reflection.push_constant_size);
+		}
+	}
+
+	// Set numbers index the layout array, so unused numbers below the highest one get an empty layout
+	vector<vk::DescriptorSetLayout> set_layouts;
+	string pipeline_key;
+	uint32_t set_count = sets.empty() ? 0 : sets.rbegin()->first + 1;
+	for (uint32_t set = 0; set < set_count; set++){
+		vector<vk::DescriptorSetLayoutBinding> bindings;
+		string key;
+		for (auto & binding : sets[set]){
+			bindings.push_back(binding.second);
+			key += to_string(binding.second.binding) + ":" + to_string(uint32_t(binding.second.descriptorType)) + ":" +
+				   to_string(binding.second.descriptorCount) + ":" + to_string(uint32_t(binding.second.stageFlags)) + ";";
+		}
+		if (!descriptor_set_layouts.count(key)){
+			descriptor_set_layouts[key] = device->createDescriptorSetLayout(
+				vk::DescriptorSetLayoutCreateInfo(vk::DescriptorSetLayoutCreateFlags(), bindings.size(), bindings.data())).value;
+		}
+		set_layouts.push_back(descriptor_set_layouts[key]);
+		pipeline_key += key + "|";
+	}
+
+	vector<vk::PushConstantRange> push_constant_ranges;
+	if (push_constant_size){
+		push_constant_ranges.push_back(vk::PushConstantRange(push_constant_stages, 0, push_constant_size));
+	}
+	pipeline_key += to_string(uint32_t(push_constant_stages)) + ":" + to_string(push_constant_size);
+	if (set_layouts_out){
+		*set_layouts_out = set_layouts;
+	}
+	if (!pipeline_layouts.count(pipeline_key)){
+		pipeline_layouts[pipeline_key] = device->createPipelineLayout(
+			vk::PipelineLayoutCreateInfo(
+				vk::PipelineLayoutCreateFlags(),
+				set_layouts.size(), set_layouts.data(),
+				push_constant_ranges.size(), push_constant_ranges.data())).value;
+	}
+	return pipeline_layouts[pipeline_key];
+}
+
+vk::Pipeline VkRenderer::BuildPipeline(const GraphicsPipelineInfo & info){
+	vector<vk::PipelineShaderStageCreateInfo> shader_stages;
+	// ..sized up front, the stage infos point into these
+	vector<vector<vk::SpecializationMapEntry>> specialization_entries(info.shaders.size());
+	vector<vector<uint8_t>> specialization_data(info.shaders.size());
+	vector<vk::SpecializationInfo> specialization_infos(info.shaders.size());
+	for (size_t i = 0; i < info.shaders.size(); i++){
+		auto & shader = info.shaders[i];
+		shader_stages.push_back(vk::PipelineShaderStageCreateInfo(
+			vk::PipelineShaderStageCreateFlags(),
+			shader.stage,
+			LoadShaderModule(shader.file), "main"));
+		if (!shader.constants.Empty()){
+			specialization_infos[i] = shader.constants.Info(specialization_entries[i], specialization_data[i]);
+			shader_stages.back().pSpecializationInfo = &specialization_infos[i];
+		}
+
+		// A vertex shader reading attributes the pipeline doesn't provide (or in another format) reads garbage
+		if (shader.stage == vk::ShaderStageFlagBits::eVertex && shader_reflections.count(shader.file) &&
+			!shader_reflections[shader.file].ValidateVertexInput(info.vertex_attributes, shader.file)){
+			ShaderError("Vertex shader inputs don't match the pipeline's vertex attributes (see the log)", shader.file);
+			throw runtime_error("vertex shader inputs don't match the vertex attributes!");
+		}
+	}
+
+	//A lone compute stage is all a compute pipeline needs
+	if (shader_stages.size() == 1 && shader_stages[0].stage == vk::ShaderStageFlagBits::eCompute){
+		vk::Pipeline pipeline = device->createComputePipeline(pipeline_cache,
+			vk::ComputePipelineCreateInfo(vk::PipelineCreateFlags(), shader_stages[0], GetPipelineLayout(info))).value;
+		DestroyShaderModule(info.shaders[0].file);
+		return pipeline;
+	}
+
+	auto vertex_input_info =
+	vk::PipelineVertexInputStateCreateInfo(
+		vk::PipelineVertexInputStateCreateFlags(),
+		info.vertex_bindings.size(), info.vertex_bindings.data(),
+		info.vertex_attributes.size(), info.vertex_attributes.data()
+	);
+
+	auto input_assembly =
+	vk::PipelineInputAssemblyStateCreateInfo(
+		vk::PipelineInputAssemblyStateCreateFlags(),
+		info.topology,
+		VK_FALSE
+	);
+
+	auto viewport_state = vk::PipelineViewportStateCreateInfo(
+		vk::PipelineViewportStateCreateFlags(),
+		viewports.size(),
+		viewports.data(),
+		scissors.size(),
+		scissors.data()
+	);
+
+	auto color_blend =
+	vk::PipelineColorBlendStateCreateInfo(
+		vk::PipelineColorBlendStateCreateFlags(),
+		VK_FALSE, vk::LogicOp::eCopy,      //LogicOpEnable, LogicOp
+		info.blend_attachments.size(),     //AttachmentCount
+		info.blend_attachments.data()      //Attachments
+	);
+
+	auto pipeline_dynamic_states =
+	vk::PipelineDynamicStateCreateInfo(
+		vk::PipelineDynamicStateCreateFlags(),
+		info.dynamic_states.size(),
+		info.dynamic_states.data()
+	);
+
+	auto pipeline_info =
+	vk::GraphicsPipelineCreateInfo(
+		vk::PipelineCreateFlags(),
+		shader_stages.size(), shader_stages.data(),    //stageCount, shaderStages
+		&vertex_input_info, &input_assembly, nullptr,  //vertexInputState, inputAssemblyState, tesselationState
+		&viewport_state, &rasterizer,                  //viewportState, rasterizationState
+		&multisampler, &info.depth_stencil_tests,      //multisampleState, depthStencilTests,
+		&color_blend, &pipeline_dynamic_states,        //colorblendState, pipelineDynamicStates,
+		GetPipelineLayout(info),                       //pipelineLayout
+		info.render_pass ? info.render_pass : renderpass, //renderPass
+		info.subpass, nullptr, -1);                    //subPass
+
+#ifdef VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME
+	//With dynamic rendering, pipelines without a render pass are made for the formats they draw into
+	vector<vk::Format> color_formats;
+	vk::Format depth_format;
+	RenderingFormats(info, color_formats, depth_format);
+	auto rendering_info = vk::PipelineRenderingCreateInfoKHR(
+		0, color_formats.size(), color_formats.data(),
+		depth_format, HasStencil(depth_format) ? depth_format : vk::Format::eUndefined);
+	if (dynamic_rendering_active && !info.render_pass){
+		pipeline_info.pNext = &rendering_info;
+	}
+#endif
+
+	vk::Pipeline pipeline = device->createGraphicsPipeline(pipeline_cache, pipeline_info).value;
+
+	// ..the modules are only needed while the pipeline is created
+	for (auto & shader : info.shaders){
+		DestroyShaderModule(shader.file);
+	}
+	return pipeline;
+}
+
+vk::Pipeline VkRenderer::CreateGraphicsPipeline(string name, const GraphicsPipelineInfo & info){
+	pipeline_infos[name] = info;
+	pipelines[name] = BuildPipeline(info);
+	return pipelines[name];
+}
+
+vk::Pipeline VkRenderer::GetPipelineVariant(string name, const map<vk::ShaderStageFlagBits, SpecializationConstants> & stage_constants){
+	GraphicsPipelineInfo variant_info = pipeline_infos.at(name);
+	for (auto & shader : variant_info.shaders){
+		if (stage_constants.count(shader.stage)){
+			shader.constants.Merge(stage_constants.at(shader.stage));
+		}
+	}
+
+	// The key is the base pipeline plus every stage's final constants, so asking twice for the same values finds the same pipeline
+	string key = name;
+	for (auto & shader : variant_info.shaders){
+		if (!shader.constants.Empty()){
+			key += "|" + vk::to_string(shader.stage) + ":" + shader.constants.Key();
+		}
+	}
+	if (key == name || pipelines.count(key)){
+		return pipelines[key];
+	}
+	return CreateGraphicsPipeline(key, variant_info);
+}
+
+vk::Pipeline VkRenderer::GetPassPipeline(string name, vk::RenderPass render_pass, uint32_t subpass){
+	// Render passes last until shutdown, so their handles can key the pipelines made for them
+	string key = name + "@" + to_string(uint64_t(VkRenderPass(render_pass))) + ":" + to_string(subpass);
+	if (pipelines.count(key)){
+		return pipelines[key];
+	}
+	GraphicsPipelineInfo pass_info = pipeline_infos.at(name);
+	pass_info.render_pass = render_pass;
+	pass_info.subpass = subpass;
+	target_pipelines.insert(key);
+	return CreateGraphicsPipeline(key, pass_info);
+}
+
+vk::Pipeline VkRenderer::GetRenderingPipeline(string name, const vector<vk::Format> & color_formats, vk::Format depth_format){
+	GraphicsPipelineInfo rendering_info = pipeline_infos.at(name);
+	vector<vk::Format> own_colors;
+	vk::Format own_depth;
+	RenderingFormats(rendering_info, own_colors, own_depth);
+	if (own_colors == color_formats && own_depth == depth_format){
+		return pipelines[name];
+	}
+
+	string key = name + "@";
+	for (auto format : color_formats){
+		key += to_string(uint32_t(format)) + ",";
+	}
+	key += to_string(uint32_t(depth_format));
+	if (pipelines.count(key)){
+		return pipelines[key];
+	}
+	rendering_info.color_formats = color_formats;
+	rendering_info.depth_format = depth_format;
+	target_pipelines.insert(key);
+	return CreateGraphicsPipeline(key, rendering_info);
+}
+
+void VkRenderer::RenderingFormats(const GraphicsPipelineInfo & info, vector<vk::Format> & color_formats, vk::Format & depth_format){
+	//...the scene's, unless the pipeline names its own
+	bool scene = info.color_formats.empty() && info.depth_format == vk::Format::eUndefined;
+	color_formats = scene ? vector<vk::Format>{GetSceneFormat()} : info.color_formats;
+	depth_format = scene ? depth_buffer_format : info.depth_format;
+}
+
+vk::Pipeline VkRenderer::CreateComputePipeline(string name, const ShaderStage & shader){
+	GraphicsPipelineInfo compute_info;
+	compute_info.shaders = {shader};
+	compute_info.shaders[0].stage = vk::ShaderStageFlagBits::eCompute;
+	return CreateGraphicsPipeline(name, compute_info);
+}
+
+void VkRenderer::Dispatch(vk::CommandBuffer command_buffer, string name, const vector<DescriptorBinding> & bindings,
+						  uint32_t groups_x, uint32_t groups_y, uint32_t groups_z, const void * push_constants, uint32_t push_constant_size){
+	const GraphicsPipelineInfo & info = pipeline_infos.at(name);
+	vector<vk::DescriptorSetLayout> set_layouts;
+	vk::PipelineLayout layout = GetPipelineLayout(info, &set_layouts);
+	command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipelines[name], dldid);
+
+	if (!bindings.empty()){
+		//The types come from the shader, so a binding it doesn't declare (or a pipeline with its own layout) can't be written
+		auto & reflection = shader_reflections[info.shaders[0].file];
+		if (set_layouts.empty() || !reflection.descriptor_sets.count(0)){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Pipeline %s has no reflected descriptor set 0 to bind to", name.c_str());
+			return;
+		}
+		vk::DescriptorSet set = AllocateDescriptorSet(set_layouts[0]);
+		if (!linear_sampler){
+			linear_sampler = device->createSampler(vk::SamplerCreateInfo()
+				.setMagFilter(vk::Filter::eLinear).setMinFilter(vk::Filter::eLinear)
+				.setAddressModeU(vk::SamplerAddressMode::eClampToEdge)
+				.setAddressModeV(vk::SamplerAddressMode::eClampToEdge)
+				.setAddressModeW(vk::SamplerAddressMode::eClampToEdge)).value;
+		}
+
+		// ..sized up front, the writes point into these
+		vector<vk::DescriptorImageInfo> image_infos(bindings.size());
+		vector<vk::DescriptorBufferInfo> buffer_infos(bindings.size());
+		vector<vk::WriteDescriptorSet> writes;
+		for (size_t i = 0; i < bindings.size(); i++){
+			auto & binding = bindings[i];
+			auto & declared = reflection.descriptor_sets[0];
+			auto found = find_if(declared.begin(), declared.end(), [&](const vk::DescriptorSetLayoutBinding & candidate){
+				return candidate.binding == binding.binding; });
+			if (found == declared.end()){
+				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Pipeline %s has nothing at binding %u", name.c_str(), binding.binding);
+				continue;
+			}
+			vk::WriteDescriptorSet write(set, binding.binding, 0, 1, found->descriptorType);
+			switch (found->descriptorType){
+				case vk::DescriptorType::eStorageImage:
+					image_infos[i] = vk::DescriptorImageInfo(nullptr, binding.view, vk::ImageLayout::eGeneral);
+					write.setPImageInfo(&image_infos[i]);
+					break;
+				case vk::DescriptorType::eCombinedImageSampler:
+				case vk::DescriptorType::eSampledImage:
+				case vk::DescriptorType::eSampler:
+					image_infos[i] = vk::DescriptorImageInfo(linear_sampler, binding.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+					write.setPImageInfo(&image_infos[i]);
+					break;
+				default:
+					buffer_infos[i] = vk::DescriptorBufferInfo(binding.buffer, binding.offset, binding.range);
+					write.setPBufferInfo(&buffer_infos[i]);
+					break;
+			}
+			writes.push_back(write);
+		}
+		device->updateDescriptorSets(writes, nullptr, dldid);
+		command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, layout, 0, set, nullptr, dldid);
+	}
+
+	if (push_constant_size){
+		command_buffer.pushConstants(layout, vk::ShaderStageFlagBits::eCompute, 0, push_constant_size, push_constants, dldid);
+	}
+	command_buffer.dispatch(groups_x, groups_y, groups_z, dldid);
+}
+
+vk::DescriptorSet VkRenderer::AllocateDescriptorSet(vk::DescriptorSetLayout layout){
+	auto & pools = descriptor_pools[current_buffer];
+	if (!pools.empty()){
+		auto sets = device->allocateDescriptorSets(vk::DescriptorSetAllocateInfo(pools.back(), 1, &layout), dldid);
+		if (sets.result == vk::Result::eSuccess){
+			return sets.value[0];
+		}
+	}
+
+	//The last pool is full (or there's none yet), another one is added for this buffer's frames
+	vector<vk::DescriptorPoolSize> pool_sizes;
+	for (auto type : {vk::DescriptorType::eSampler, vk::DescriptorType::eCombinedImageSampler, vk::DescriptorType::eSampledImage,
+					  vk::DescriptorType::eStorageImage, vk::DescriptorType::eUniformBuffer, vk::DescriptorType::eStorageBuffer}){
+		pool_sizes.push_back(vk::DescriptorPoolSize(type, 4 * DESCRIPTOR_POOL_SETS));
+	}
+	pools.push_back(device->createDescriptorPool(vk::DescriptorPoolCreateInfo(
+		vk::DescriptorPoolCreateFlags(), DESCRIPTOR_POOL_SETS, pool_sizes.size(), pool_sizes.data())).value);
+	return device->allocateDescriptorSets(vk::DescriptorSetAllocateInfo(pools.back(), 1, &layout), dldid).value[0];
+}
+
+void VkRenderer::DestroyDescriptorPools(){
+	for (auto & pools : descriptor_pools){
+		for (auto pool : pools){
+			device->destroyDescriptorPool(pool);
+		}
+	}
+	descriptor_pools.clear();
+	if (linear_sampler){
+		device->destroySampler(linear_sampler);
+	}
+}
+
+void VkRenderer::ReloadShaders(const vector<string> & shader_files){
+	reloading_shaders = true;
+	for (auto & file : shader_files){
+		if (shader_cache.count(file)){ DestroyShaderModule(file); }
+	}
+
+	for (auto & pipeline_info : pipeline_infos){
+		bool uses_changed_shader = false;
+		for (auto & shader : pipeline_info.second.shaders){
+			if (find(shader_files.begin(), shader_files.end(), shader.file) != shader_files.end()){
+				uses_changed_shader = true;
+			}
+		}
+		if (!uses_changed_shader){ continue; }
+
+		// A shader that doesn't load or link keeps the old pipeline running
+		vk::Pipeline pipeline = nullptr;
+		try { pipeline = BuildPipeline(pipeline_info.second); }
+		catch (const runtime_error &) {
+			for (auto & shader : pipeline_info.second.shaders){
+				if (shader_cache.count(shader.file)){ DestroyShaderModule(shader.file); }
+			}
+		}
+		if (!pipeline){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Couldn't rebuild pipeline %s, keeping the old one", pipeline_info.first.c_str());
+			continue;
+		}
+		vk::Pipeline retired_pipeline = pipelines[pipeline_info.first];
+		Retire([this, retired_pipeline]{ device->destroyPipeline(retired_pipeline); });
+		pipelines[pipeline_info.first] = pipeline;
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Rebuilt pipeline %s", pipeline_info.first.c_str());
+	}
+	reloading_shaders = false;
+}
+
+void VkRenderer::RebuildPipelines(){
+	//Pipelines made for other targets (GetPassPipeline, GetRenderingPipeline) are dropped, the next frame asks for them again
+	for (auto & name : target_pipelines){
+		vk::Pipeline retired_pipeline = pipelines[name];
+		Retire([this, retired_pipeline]{ device->destroyPipeline(retired_pipeline); });
+		pipelines.erase(name);
+		pipeline_infos.erase(name);
+	}
+	target_pipelines.clear();
+
+	for (auto & pipeline_info : pipeline_infos){
+		// ..compute pipelines don't draw into anything
+		auto & shaders = pipeline_info.second.shaders;
+		if (shaders.size() == 1 && shaders[0].stage == vk::ShaderStageFlagBits::eCompute){ continue; }
+		vk::Pipeline pipeline = nullptr;
+		try { pipeline = BuildPipeline(pipeline_info.second); }
+		catch (const runtime_error &) {}
+		if (!pipeline){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Couldn't rebuild pipeline %s for the new render pass", pipeline_info.first.c_str());
+			continue;
+		}
+		vk::Pipeline retired_pipeline = pipelines[pipeline_info.first];
+		Retire([this, retired_pipeline]{ device->destroyPipeline(retired_pipeline); });
+		pipelines[pipeline_info.first] = pipeline;
+	}
+}
+
+void VkRenderer::Retire(function<void()> destroy, bool recording){
+	uint64_t frame = recording ? frame_count + 1 : frame_count;
+	if (retired_objects.empty() && FrameRetired(frame)){
+		destroy();
+		return;
+	}
+	retired_objects.push_back({frame, destroy});
+}
+
+void VkRenderer::DestroyRetiredObjects(bool all){
+	// Objects are retired in frame order, so this stops at the first one that's still in use
+	size_t destroyed = 0;
+	while (destroyed < retired_objects.size() && (all || FrameRetired(retired_objects[destroyed].first))){
+		retired_objects[destroyed].second();
+		destroyed++;
+	}
+	retired_objects.erase(retired_objects.begin(), retired_objects.begin() + destroyed);
+}
 
 void VkRenderer::DestroyPipelines(){
-	device->destroyPipelineLayout(pipeline_layout);
+	for (auto layout: pipeline_layouts) {
+		device->destroyPipelineLayout(layout.second);
+	}
+	for (auto layout: descriptor_set_layouts) {
+		device->destroyDescriptorSetLayout(layout.second);
+	}
 	for (auto pipeline: pipelines) {
 		device->destroyPipeline(pipeline.second);
 	}
@@ -699,15 +1990,69 @@ int VkRenderer::ResizeScissors(int width, int height, int i) {
 	return 1;
 }
 
+bool VkRenderer::ImportHostBuffer(const void * data, vk::DeviceSize size, const void * range, size_t range_size,
+								  vk::Buffer & buffer, vk::DeviceMemory & memory, vk::DeviceSize & offset){
+	if (!capabilities.external_memory_host || !host_pointer_alignment){ return false; }
+
+	// Both the imported pointer and size have to be multiples of the alignment, so the region is rounded outwards,
+	// which is only allowed if the rounded region is still memory the caller owns.
+	uintptr_t alignment_mask = uintptr_t(host_pointer_alignment - 1);
+	uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~alignment_mask;
+	uintptr_t end = (reinterpret_cast<uintptr_t>(data) + size + alignment_mask) & ~alignment_mask;
+	uintptr_t range_begin = reinterpret_cast<uintptr_t>(range);
+	if (begin < range_begin || end > range_begin + range_size){ return false; }
+	void * host_pointer = reinterpret_cast<void *>(begin);
+	vk::DeviceSize import_size = end - begin;
+
+	auto host_handle = vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT;
+	auto pointer_properties = device->getMemoryHostPointerPropertiesEXT(host_handle, host_pointer, dl);
+	if (pointer_properties.result != vk::Result::eSuccess){ return false; }
+
+	auto external_info = vk::ExternalMemoryBufferCreateInfo(host_handle);
+	auto buffer_info = vk::BufferCreateInfo(
+		vk::BufferCreateFlags(), import_size,
+		vk::BufferUsageFlagBits::eTransferSrc,
+		vk::SharingMode::eExclusive);
+	buffer_info.pNext = &external_info;
+	buffer = device->createBuffer(buffer_info).value;
+	if (!buffer){ return false; }
+
+	auto requirements = device->getBufferMemoryRequirements(buffer);
+	uint32_t type_bits = requirements.memoryTypeBits & pointer_properties.value.memoryTypeBits;
+	uint32_t memory_type = 0;
+	while (memory_type < gpu_memory_info.memoryTypeCount && !(type_bits & (1 << memory_type))){ memory_type++; }
+	if (memory_type == gpu_memory_info.memoryTypeCount || requirements.size > import_size){
+		device->destroyBuffer(buffer);
+		return false;
+	}
+
+	auto import_info = vk::ImportMemoryHostPointerInfoEXT(host_handle, host_pointer);
+	auto allocate_info = vk::MemoryAllocateInfo(import_size, memory_type);
+	allocate_info.pNext = &import_info;
+	memory = device->allocateMemory(allocate_info).value;
+	if (!memory || device->bindBufferMemory(buffer, memory, 0) != vk::Result::eSuccess){
+		ReleaseHostBuffer(buffer, memory);
+		return false;
+	}
+
+	offset = reinterpret_cast<uintptr_t>(data) - begin;
+	return true;
+}
+
+void VkRenderer::ReleaseHostBuffer(vk::Buffer buffer, vk::DeviceMemory memory){
+	device->destroyBuffer(buffer);
+	if (memory){
+		device->freeMemory(memory);
+	}
+}
+
 static vector<char> ReadShaderFile(string filename)
 {
 	std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
 	if (!file.is_open())
 	{	
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Rendering Error!",  string("Can't load shader, might not be in path: \n" + filename).data(), NULL);
-		throw runtime_error("failed to open file!");
-		
+		return {}; // ..LoadShaderModule reports it
 	}
 
 	size_t file_size = file.tellg();
@@ -731,18 +2076,58 @@ uint32_t FindMemoryType(VkRenderer * renderer, uint32_t type_filter, vk::MemoryP
 	throw "failed to find the most suitable memory type!";
 }
 */
+void VkRenderer::ShaderError(string reason, string filename) {
+	//Startup can't go on without the shader, so it's shown. While hot reloading it's only logged: the old pipeline keeps running
+	if (!reloading_shaders){
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Rendering Error!", string(reason + ": \n" + filename).data(), NULL);
+	}
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "%s: %s", reason.c_str(), filename.c_str());
+}
+
 vk::ShaderModule VkRenderer::LoadShaderModule(string filename) {
 	if (!shader_cache.count(filename)){
-		vector<char> binary = ReadShaderFile(filename);
+		vector<char> binary;
+		vector<uint32_t> spirv;
+		size_t word_count = 0;
+#ifdef VK_DEBUG
+		//Debug builds prefer the files (they get hot reloaded), the archive only stands in for missing ones
+		const uint32_t * code = ifstream(filename).good() ? nullptr : shader_archive.Find(filename, word_count);
+#else
+		const uint32_t * code = shader_archive.Find(filename, word_count);
+#endif
+		if (!code){
+			if (ShaderCompiler::IsGLSL(filename)){
+				//GLSL gets compiled (or taken from the compiled shader cache)
+				spirv = shader_compiler.Compile(filename);
+				if (spirv.empty()){
+					ShaderError("Can't compile shader (see the log for errors)", filename);
+					throw runtime_error("failed to compile shader!");
+				}
+				code = spirv.data();
+				word_count = spirv.size();
+			}
+			else {
+				binary = ReadShaderFile(filename);
+				if (binary.empty()){
+					ShaderError("Can't load shader, might not be in path", filename);
+					throw runtime_error("failed to open file!");
+				}
+				code = reinterpret_cast<const uint32_t *>(binary.data());
+				word_count = binary.size() / sizeof(uint32_t);
+			}
+		}
 		shader_cache[filename] = device->createShaderModule(
 			vk::ShaderModuleCreateInfo(
 				vk::ShaderModuleCreateFlags(),
-				binary.size(),
-				reinterpret_cast<const uint32_t *>(binary.data())
+				word_count * sizeof(uint32_t),
+				code
 				)).value;
 		if (!shader_cache[filename]){
 			throw runtime_error("We couldn't create a shader module");
 		}
+		ShaderReflection reflection;
+		reflection.Parse(code, word_count);
+		shader_reflections[filename] = reflection;
 	}
 	return shader_cache[filename];
 }
@@ -841,80 +2226,221 @@ void VkRenderer::DestroyDebug()
 //________________________________________________________________________________
 
 // VERTEX BUFFER CLASS____________________________________________________________
-VertexBuffer::VertexBuffer(vector<Vertex> vertices, VkRenderer * renderer){
+VertexBuffer::VertexBuffer(const vector<Vertex> & vertices, VkRenderer * renderer, BufferUpload * upload){
 	allocator = &renderer->gpu_allocator;
 	gpu_properties = renderer->gpu_properties;
-	switch (gpu_properties.deviceType){
-		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:{
-			staging_buffer_info.setSize(sizeof(vertices[0]) * vertices.size());
-			staging_buffer_info.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
-			vma::AllocationCreateInfo staging_alloc_info;
-			staging_alloc_info.setUsage(vma::MemoryUsage::eCpuOnly);
-			tie(staging_buffer, staged_memory) = allocator->createBuffer(staging_buffer_info, staging_alloc_info).value;
-			
-			if (!staging_buffer){
-				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Create Buffer Failed");
-				SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Error!", " Couldn't create Staging Buffer.\n Make sure information is filled out correctly.", NULL);
-				throw "Staging Buffer Creation Failed!";
+	dispatch = &renderer->dldid;
+	vertex_count = vertices.size();
+	UploadBuffer(renderer, vertices.data(), sizeof(Vertex) * vertices.size(),
+		vk::BufferUsageFlagBits::eVertexBuffer, vertex_buffer, buffer_memory, nullptr, upload);
+}
+
+VertexBuffer::VertexBuffer(const vector<Vertex> & vertices, const vector<uint32_t> & indices, VkRenderer * renderer, BufferUpload * upload)
+	: VertexBuffer(vertices, renderer, upload){
+	if (!indices.empty()){
+		index_count = indices.size();
+		index_type = vk::IndexType::eUint32;
+		UploadBuffer(renderer, indices.data(), sizeof(uint32_t) * indices.size(),
+			vk::BufferUsageFlagBits::eIndexBuffer, index_buffer, index_memory, nullptr, upload);
+	}
+}
+
+VertexBuffer::VertexBuffer(const MeshFile & mesh, VkRenderer * renderer, BufferUpload * upload){
+	allocator = &renderer->gpu_allocator;
+	gpu_properties = renderer->gpu_properties;
+	dispatch = &renderer->dldid;
+	if (mesh.header.vertex_stride != sizeof(Vertex)){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "The mesh's vertex layout doesn't match the renderer's Vertex struct");
+		if (!upload){
+			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Asset Error!", " The mesh's vertex layout doesn't match the renderer's Vertex struct.\n Convert it again with mesh_convert.", NULL);
+		}
+		throw runtime_error("mesh vertex stride mismatch");
+	}
+	vertex_count = mesh.header.vertex_count;
+	try {
+		UploadBuffer(renderer, mesh.Vertices(), mesh.header.vertex_size,
+			vk::BufferUsageFlagBits::eVertexBuffer, vertex_buffer, buffer_memory, &mesh, upload);
+
+		if (mesh.header.index_type != MESH_INDEX_NONE){
+			index_count = mesh.header.index_count;
+			index_type = (mesh.header.index_type == MESH_INDEX_UINT32) ? vk::IndexType::eUint32 : vk::IndexType::eUint16;
+			UploadBuffer(renderer, mesh.Indices(), mesh.header.index_size,
+				vk::BufferUsageFlagBits::eIndexBuffer, index_buffer, index_memory, &mesh, upload);
+		}
+	}
+	catch (...){
+		// The destructor doesn't run for a half built buffer, so what was created goes here. An upload may have
+		// recorded copies into it already, then it goes once the upload's copies have run.
+		vma::Allocator * owner = allocator;
+		for (auto created : {make_pair(vertex_buffer, buffer_memory), make_pair(index_buffer, index_memory)}){
+			if (!created.first){ continue; }
+			if (upload){
+				upload->releases.push_back([owner, created]{ owner->destroyBuffer(created.first, created.second); });
 			}
-			break;
-		}	
-		default:break;
+			else {
+				owner->destroyBuffer(created.first, created.second);
+			}
+		}
+		throw;
 	}
-	buffer_info.setSize(sizeof(vertices[0]) * vertices.size());
-	buffer_info.setUsage(vk::BufferUsageFlagBits::eVertexBuffer);
+}
+
+void VertexBuffer::UploadBuffer(VkRenderer * renderer, const void * data, vk::DeviceSize size, vk::BufferUsageFlags usage,
+								vk::Buffer & buffer, vma::Allocation & memory, const MeshFile * source, BufferUpload * upload){
+	bool staged = (gpu_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU);
+	auto buffer_info = vk::BufferCreateInfo();
+	buffer_info.setSize(size);
+	buffer_info.setUsage(usage | vk::BufferUsageFlagBits::eTransferDst); // ..Write copies into it even when it's host visible
 	vma::AllocationCreateInfo alloc_info = {};
-	switch (gpu_properties.deviceType){
-		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:{
-			buffer_info.usage |= vk::BufferUsageFlagBits::eTransferDst;
-			alloc_info.setUsage(vma::MemoryUsage::eGpuOnly);
-			break;
-		}
-		default: alloc_info.setUsage(vma::MemoryUsage::eCpuToGpu); break;
+	if (staged){
+		alloc_info.setUsage(vma::MemoryUsage::eGpuOnly);
+	}
+	else {
+		alloc_info.setUsage(vma::MemoryUsage::eCpuToGpu);
+		alloc_info.setFlags(vma::AllocationCreateFlagBits::eMapped);
 	}
 
-	tie(vertex_buffer, buffer_memory) = allocator->createBuffer(buffer_info, alloc_info).value;
-	if (!vertex_buffer){
+	tie(buffer, memory) = allocator->createBuffer(buffer_info, alloc_info).value;
+	if (!buffer){
 		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Create Buffer Failed");
-		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Error!", " Couldn't create Vertex Buffer.\n Make sure information is filled out correctly.", NULL);
+		if (!upload){ // ..uploads are recorded from the render loop, which a message box would stall
+			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Error!", " Couldn't create Vertex Buffer.\n Make sure information is filled out correctly.", NULL);
+		}
 		throw "Vertex Buffer Creation Failed!";
 	}
-	
-	switch (gpu_properties.deviceType){
-		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:{
-			// Load vertex memory onto staging buffer
-			void * data = allocator->mapMemory(staged_memory).value;
-			memcpy(data, vertices.data(), (size_t)staging_buffer_info.size);
-			allocator->unmapMemory(staged_memory);
-
-			// Transfer Memory to GPU.
-			vector<vk::CommandBuffer> command_buffers = renderer->GetCommandBuffers(vk::CommandBufferLevel::ePrimary, 1);
-			command_buffers[0].begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
-			auto copy_info = vk::BufferCopy();
-			copy_info.setSize(sizeof(vertices[0]) * vertices.size());
-			command_buffers[0].copyBuffer(staging_buffer, vertex_buffer, copy_info);
-			command_buffers[0].end();
-			auto submit_info = vk::SubmitInfo();
-			submit_info.commandBufferCount = command_buffers.size();
-			submit_info.pCommandBuffers = &command_buffers[0];
-
-			renderer->graphics_queue.submit(submit_info, nullptr);
-			renderer->graphics_queue.waitIdle();
-
-			// Cleanup everything used.
-			renderer->device->freeCommandBuffers(renderer->command_pool, command_buffers);
-			allocator->destroyBuffer(staging_buffer, staged_memory);
-		}
-		default:{
-			void * data = allocator->mapMemory(buffer_memory).value;
-			//data = vertices.data();
-			memcpy(data, vertices.data(), (size_t)buffer_info.size);
-			allocator->unmapMemory(buffer_memory);
-			break;
+
+	CopyToBuffer(renderer, data, size, buffer, memory, 0, source, upload);
+}
+
+void VertexBuffer::CopyToBuffer(VkRenderer * renderer, const void * data, vk::DeviceSize size, vk::Buffer buffer, vma::Allocation memory,
+								vk::DeviceSize offset, const MeshFile * source, BufferUpload * upload){
+	if (gpu_properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU){
+		// Host visible memory (integrated GPUs), the data goes straight into the buffer
+		void * mapped = allocator->getAllocationInfo(memory).pMappedData;
+		memcpy(static_cast<char *>(mapped) + offset, data, (size_t)size);
+		allocator->flushAllocation(memory, offset, size);
+		return;
+	}
+
+	vk::Buffer staging_buffer = nullptr;
+	vma::Allocation staged_memory = nullptr;
+	vma::AllocationInfo staged_info = {};
+	vk::DeviceMemory imported_memory = nullptr;
+	vk::DeviceSize source_offset = 0;
+
+	// Data coming from a mapped file can be imported as device memory, so the GPU copies it out of the page cache itself.
+	bool imported = source &&
+		renderer->ImportHostBuffer(data, size, source->Mapping(), source->MappingSize(), staging_buffer, imported_memory, source_offset);
+
+	// ..or staged in the upload's ring while it has room
+	bool ringed = !imported && upload && upload->staging_limit - upload->staging_offset >= size;
+	if (ringed){
+		staging_buffer = upload->staging_buffer;
+		source_offset = upload->staging_offset;
+		memcpy(upload->staging_data + source_offset, data, (size_t)size);
+		upload->staging_offset += size;
+	}
+
+	// Otherwise the staging buffer is created already mapped, so the source (which may be a file mapping) is copied exactly once.
+	if (!imported && !ringed){
+		auto staging_buffer_info = vk::BufferCreateInfo();
+		staging_buffer_info.setSize(size);
+		staging_buffer_info.setUsage(vk::BufferUsageFlagBits::eTransferSrc);
+		vma::AllocationCreateInfo staging_alloc_info;
+		staging_alloc_info.setUsage(vma::MemoryUsage::eCpuOnly);
+		staging_alloc_info.setFlags(vma::AllocationCreateFlagBits::eMapped);
+		tie(staging_buffer, staged_memory) = allocator->createBuffer(staging_buffer_info, staging_alloc_info, staged_info).value;
+
+		if (!staging_buffer){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Create Buffer Failed");
+			if (!upload){
+				SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Vulkan Error!", " Couldn't create Staging Buffer.\n Make sure information is filled out correctly.", NULL);
+			}
+			throw "Staging Buffer Creation Failed!";
+		}
+
+		// Load memory onto the staging buffer
+		memcpy(staged_info.pMappedData, data, (size_t)size);
+	}
+
+	// An upload only records the copy, its owner frees the staging memory once the copy has run
+	if (upload){
+		auto copy_info = vk::BufferCopy(source_offset, offset, size);
+		upload->command_buffer.copyBuffer(staging_buffer, buffer, copy_info, renderer->dldid);
+		if (imported){
+			upload->releases.push_back([renderer, staging_buffer, imported_memory]{ renderer->ReleaseHostBuffer(staging_buffer, imported_memory); });
+		}
+		else if (!ringed){
+			vma::Allocator * owner = allocator;
+			upload->releases.push_back([owner, staging_buffer, staged_memory]{ owner->destroyBuffer(staging_buffer, staged_memory); });
 		}
+		return;
+	}
+
+	// Transfer Memory to GPU.
+	vector<vk::CommandBuffer> command_buffers = renderer->GetCommandBuffers(vk::CommandBufferLevel::ePrimary, 1);
+	command_buffers[0].begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	auto copy_info = vk::BufferCopy();
+	copy_info.setSrcOffset(source_offset);
+	copy_info.setDstOffset(offset);
+	copy_info.setSize(size);
+	command_buffers[0].copyBuffer(staging_buffer, buffer, copy_info);
+	command_buffers[0].end();
+	auto submit_info = vk::SubmitInfo();
+	submit_info.commandBufferCount = command_buffers.size();
+	submit_info.pCommandBuffers = &command_buffers[0];
+
+	// ..waiting for this copy only, not for everything else on the queue to drain
+	vk::Fence copied = renderer->device->createFence(vk::FenceCreateInfo()).value;
+	renderer->graphics_queue.submit(submit_info, copied);
+	renderer->device->waitForFences(copied, VK_TRUE, UINT64_MAX);
+	renderer->device->destroyFence(copied);
+
+	// Cleanup everything used.
+	renderer->device->freeCommandBuffers(renderer->command_pool, command_buffers);
+	if (imported){
+		renderer->ReleaseHostBuffer(staging_buffer, imported_memory);
+		return;
+	}
+	allocator->destroyBuffer(staging_buffer, staged_memory);
+}
+
+void VertexBuffer::Write(VkRenderer * renderer, const void * vertices, vk::DeviceSize offset, vk::DeviceSize size, BufferUpload & upload){
+	// Frames in flight may still be reading the range that's about to be overwritten, so it's always copied on the GPU
+	// (even where the buffer is host visible), in order with them
+	auto staging_buffer_info = vk::BufferCreateInfo(vk::BufferCreateFlags(), size, vk::BufferUsageFlagBits::eTransferSrc);
+	vma::AllocationCreateInfo staging_alloc_info;
+	staging_alloc_info.setUsage(vma::MemoryUsage::eCpuOnly);
+	staging_alloc_info.setFlags(vma::AllocationCreateFlagBits::eMapped);
+	vma::AllocationInfo staged_info = {};
+	vk::Buffer staging_buffer;
+	vma::Allocation staged_memory;
+	tie(staging_buffer, staged_memory) = allocator->createBuffer(staging_buffer_info, staging_alloc_info, staged_info).value;
+	if (!staging_buffer){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Create Buffer Failed");
+		throw "Staging Buffer Creation Failed!";
 	}
+	memcpy(staged_info.pMappedData, vertices, (size_t)size);
+
+	upload.command_buffer.copyBuffer(staging_buffer, vertex_buffer, vk::BufferCopy(0, offset, size), *dispatch);
+	vma::Allocator * owner = allocator;
+	upload.releases.push_back([owner, staging_buffer, staged_memory]{ owner->destroyBuffer(staging_buffer, staged_memory); });
+}
+
+void VertexBuffer::Draw(vk::CommandBuffer command_buffer, uint32_t instance_count){
+	vk::DeviceSize offset = 0;
+	command_buffer.bindVertexBuffers(0, 1, &vertex_buffer, &offset, *dispatch);
+	if (index_buffer){
+		command_buffer.bindIndexBuffer(index_buffer, 0, index_type, *dispatch);
+		command_buffer.drawIndexed(index_count, instance_count, 0, 0, 0, *dispatch);
+		return;
+	}
+	command_buffer.draw(vertex_count, instance_count, 0, 0, *dispatch);
 }
 
 VertexBuffer::~VertexBuffer(){
+	if (index_buffer){
+		allocator->destroyBuffer(index_buffer, index_memory);
+	}
 	allocator->destroyBuffer(vertex_buffer, buffer_memory);
 }	
@@ -6,6 +6,16 @@
 
 //VMA
 #include "vk_mem_alloc.hpp"
+//Mesh Files
+#include "mesh.h"
+//Shader Compiler
+#include "shader_compiler.h"
+//SPIR-V Reflection
+#include "spirv_reflect.h"
+//Packed Shaders
+#include "shader_archive.h"
+//Startup Tracing
+#include "startup.h"
 //GLM
 #define GLM_FORCE_CTOR_INIT 
 #include <glm/glm.hpp>
@@ -20,9 +30,148 @@
 #include <vector>
 #include <array>
 #include <map>
+#include <set>
+#include <algorithm>
+#include <future>
+#include <cmath>
+#include <functional>
 
 using namespace std;
 
+// Device Dispatch
+// Hot path calls (command recording, submit, present and fence waits) take renderer->dldid as their dispatcher.
+// By default it holds the driver's entry points from vkGetDeviceProcAddr, which skips the loader's trampolines;
+// building with VK_LOADER_DISPATCH sends those calls back through the loader (tools/dispatch_benchmark.cpp compares both).
+#ifdef VK_LOADER_DISPATCH
+typedef vk::DispatchLoaderStatic DeviceDispatch;
+#else
+typedef vk::DispatchLoaderDynamic DeviceDispatch;
+#endif
+
+// Specialization Constants
+// Values for a stage's specialization constants (layout(constant_id = N) const ...), by constant id.
+// Each value keeps its type, so the shader gets the size it declared (bools become 32 bit VkBool32s).
+class SpecializationConstants {
+	public:
+		SpecializationConstants & Set(uint32_t constant_id, bool value);
+		SpecializationConstants & Set(uint32_t constant_id, int32_t value);
+		SpecializationConstants & Set(uint32_t constant_id, uint32_t value);
+		SpecializationConstants & Set(uint32_t constant_id, float value);
+		SpecializationConstants & Set(uint32_t constant_id, double value);
+		bool Empty() const { return values.empty(); }
+		// ..Adds (or replaces) all of the other constants' values
+		void Merge(const SpecializationConstants & other);
+		// ..Identifies the values, constants with different keys make different pipelines
+		string Key() const;
+		// ..Fills entries and data, which the returned info points into
+		vk::SpecializationInfo Info(vector<vk::SpecializationMapEntry> & entries, vector<uint8_t> & data) const;
+	private:
+		enum class Type : uint8_t { Bool, Int, Uint, Float, Double };
+		struct Value {
+			Type type;
+			uint64_t bits; // the value's bytes, in the low bytes
+		};
+		map<uint32_t, Value> values;
+
+		SpecializationConstants & Store(uint32_t constant_id, Type type, const void * value, size_t size);
+};
+
+// Pipeline Builder
+// Everything needed to build a graphics pipeline. The renderer keeps these around,
+// so pipelines can be rebuilt later (when a shader changes, for example).
+struct ShaderStage {
+	vk::ShaderStageFlagBits stage;
+	string file; // .spv path, as passed to LoadShaderModule
+	SpecializationConstants constants;
+
+	ShaderStage(vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex, string file = "",
+				SpecializationConstants constants = SpecializationConstants())
+		: stage(stage), file(file), constants(constants) {}
+};
+
+// A compute pipeline is one of these with a single compute stage (see CreateComputePipeline), the rest goes unused.
+struct GraphicsPipelineInfo {
+	vector<ShaderStage> shaders;
+	vector<vk::VertexInputBindingDescription> vertex_bindings;
+	vector<vk::VertexInputAttributeDescription> vertex_attributes;
+	vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+	vk::PipelineDepthStencilStateCreateInfo depth_stencil_tests;
+	vector<vk::PipelineColorBlendAttachmentState> blend_attachments;
+	vector<vk::DynamicState> dynamic_states;
+	vk::PipelineLayout layout; // left empty, the layout is built from the shaders' descriptors and push constants
+	vk::RenderPass render_pass; // left empty, the renderer's renderpass
+	uint32_t subpass = 0;       // ..and which of its subpasses the pipeline draws in
+	// With dynamic rendering (and no render_pass), the formats drawn into. Left empty, the scene's color and depth.
+	vector<vk::Format> color_formats;
+	vk::Format depth_format = vk::Format::eUndefined;
+};
+
+// Descriptor Binding
+// A resource for set 0 of a dispatch, at the binding the shader declares it at. The descriptor type comes from the
+// shader. Images are bound in the layouts the frame graph gives them (general for storage, shader read only otherwise),
+// and combined image samplers get the renderer's linear, clamped sampler.
+struct DescriptorBinding {
+	uint32_t binding;
+	vk::ImageView view;
+	vk::Buffer buffer;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize range = VK_WHOLE_SIZE;
+
+	DescriptorBinding(uint32_t binding, vk::ImageView view) : binding(binding), view(view) {}
+	DescriptorBinding(uint32_t binding, vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE)
+		: binding(binding), buffer(buffer), offset(offset), range(range) {}
+};
+
+// Capabilities
+// What the device was created with, for subsystems to check before using an optional path.
+// The extensions and features behind each flag are listed in the capability tables in renderer.cpp.
+struct RendererCapabilities {
+	bool external_memory_capabilities = false; // instance level
+	bool swapchain_colorspace = false;         // instance level, HDR color spaces
+	bool external_memory_host = false;
+	bool memory_budget = false;
+	bool dynamic_rendering = false;
+	bool present_wait = false; // present ids and waiting on them
+	vk::PhysicalDeviceFeatures features; // the core features that got enabled
+};
+
+struct CapabilityEntry;
+class FrameGraph;
+
+// Dynamic Resolution
+// The scene is drawn into its own target, at a scale of the swapchain's size, then scaled up into the swapchain image.
+// The scale follows the GPU time measured for each frame (with timestamps): it drops while frames go over the budget
+// and comes back up while they're under it. The target is allocated at max_scale when the swapchain is (re)created.
+// Without blit support for the swapchain's format the scene is drawn into the swapchain directly, and without
+// timestamps the scale stays where it is.
+struct DynamicResolution {
+	bool enabled = true;
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+	double frame_budget = 0.0; // ms of GPU time per frame, 0 takes the display's refresh interval
+	double hysteresis = 0.1;   // GPU times within this fraction of the budget leave the scale alone
+	float scale = 1.0f;        // the scale being drawn at
+	double gpu_time = 0.0;     // ms, averaged over recent frames
+};
+
+// Present Policy
+// What the swapchain's present mode is picked for. Each policy ranks the present modes, and the best one the
+// surface supports is used (FIFO is always supported, so every policy falls back to it).
+// ..LowestLatency: immediate, mailbox, FIFO relaxed, FIFO. Frames go out as soon as they're done, and may tear.
+// ..PowerSaving: FIFO, FIFO relaxed. Rendering is held to the refresh rate.
+// ..TearFreeThroughput: mailbox, FIFO, FIFO relaxed. Renders as fast as it can and shows the newest frame at each refresh.
+enum class PresentPolicy { LowestLatency, PowerSaving, TearFreeThroughput };
+
+// Surface Format Policy
+// What the swapchain's format and color space are picked for. Each policy ranks the formats it wants, and the best one
+// the surface lists (that can be drawn into) is used. The HDR policies fall back to the ones before them, down to sRGB.
+// ..SRGB: 8 bit sRGB, the least bandwidth.
+// ..HDR10: 10 bit, with the ST 2084 (PQ) transfer function. The scene is encoded for it (Rec. 2020 primaries, PQ) by a
+//   compute pass before EndScene's blit, so it's only picked when there's a scene target.
+// ..ScRGB: 16 bit float extended linear sRGB, twice the bandwidth of the others.
+// The HDR color spaces need VK_EXT_swapchain_colorspace, and a display that takes them.
+enum class SurfaceFormatPolicy { SRGB, HDR10, ScRGB };
+
 class VkRenderer
 {
   public:
@@ -32,11 +181,11 @@ class VkRenderer
 	vk::UniqueDevice device;
 	vk::PhysicalDeviceMemoryProperties gpu_memory_info;
 	uint32_t graphics_family_index;
-	vk::RenderPass renderpass;
-	vector<vk::Framebuffer> frame_buffers;
+	vk::RenderPass renderpass; // what pipelines are built against, compatible with the scene pass
 	vector<vk::Image> swapchain_buffers{};
-	vk::PipelineLayout pipeline_layout;
 	map<string, vk::Pipeline> pipelines;
+	map<string, GraphicsPipelineInfo> pipeline_infos;
+	uint64_t frame_count = 0; // number of frames submitted so far
 	int buffer_count = 3;
 	vk::Semaphore present_semaphore = nullptr;
 	vk::Semaphore render_semaphore = nullptr;
@@ -50,6 +199,13 @@ class VkRenderer
 	vma::Allocator gpu_allocator = nullptr;
 	VkPhysicalDeviceProperties gpu_properties = {};
 	vk::CommandPool command_pool = nullptr;
+	DeviceDispatch dldid; // device level dispatch, see above
+	ShaderCompiler shader_compiler;
+	RendererCapabilities capabilities;
+	DynamicResolution dynamic_resolution;
+	FrameGraph * frame_graph = nullptr; // describes each frame, see frame_graph.h
+	//Host memory import (capabilities.external_memory_host)
+	vk::DeviceSize host_pointer_alignment = 0;
 	//Array used for displaying the Vulkan device type to console
 	const char *device_type[5] = {
 		"VK_PHYSICAL_DEVICE_TYPE_OTHER",
@@ -60,26 +216,118 @@ class VkRenderer
 	};
 	
 	//__Functions__
+	// ..Creates the instance, device and pipeline cache, without a window (SDL_Vulkan_LoadLibrary has to have been called)
+	VkRenderer();
+	// ..Creates the surface, swapchain and everything drawn into, for a window made with SDL_WINDOW_VULKAN
+	void CreatePresentation(SDL_Window * window);
 	VkRenderer(SDL_Window * window);
    ~VkRenderer();
 
-	//..Returns to you a module of the .spv shader that's been loaded
+	//..Returns to you a module of the .spv shader that's been loaded, GLSL files (.vert, .frag, ...) get compiled first
+	//..Shaders packed into shaders.pak are read from there instead (in debug builds, only if the file is missing)
 	vk::ShaderModule LoadShaderModule(string filename);
 	// ..Destroys all of the shader modules if no path is given, or destroys the specified shader module;
 	void DestroyShaderModule(string shader = "");
+	// ..What the shader expects from the pipeline, filled in when its module is loaded
+	map<string, ShaderReflection> shader_reflections;
 
 	//Device Commands
 	vk::CommandPool CreateDeviceCommandPool(uint32_t index, vk::CommandPoolCreateFlagBits flags);
 	vector<vk::CommandBuffer> GetCommandBuffers(vk::CommandBufferLevel level, int buffer_count, vk::CommandPool pool = nullptr);
 	void DestroyDeviceCommandPool(vk::CommandPool * pool);
 
+	//Host Memory
+	// ..Wraps host memory in a transfer source buffer without copying it, returns false when it can't be imported.
+	// ..[data, data + size) gets rounded out to host_pointer_alignment, and has to stay inside [range, range + range_size).
+	bool ImportHostBuffer(const void * data, vk::DeviceSize size, const void * range, size_t range_size,
+						  vk::Buffer & buffer, vk::DeviceMemory & memory, vk::DeviceSize & offset);
+	void ReleaseHostBuffer(vk::Buffer buffer, vk::DeviceMemory memory);
+
 	//Rendering
 	int AcquireNextBuffer(uint32_t &buf_num);
 	void BeginRenderPresent(uint32_t &buf_num, vector<vk::CommandBuffer> buffers);
+	// ..Begins the command buffer and a new frame_graph frame, with "Scene Color" (at the current scale) and "Depth"
+	// ..to draw into, and sets the viewports and scissors scaled to match. Passes are added to frame_graph after it.
+	// ..With MSAA, "Depth" is multisampled, and the scene is drawn into "Scene Color MS" and resolved into "Scene Color".
+	void BeginScene(vk::CommandBuffer command_buffer, uint32_t buf_num);
+	// ..Scales the scene (or what source names, a post processed copy of it) up into the swapchain image ("Backbuffer"),
+	// ..records the frame graph, and ends the command buffer
+	void EndScene(vk::CommandBuffer command_buffer, uint32_t buf_num, string source = "Scene Color");
+	// ..Waits (up to timeout nanoseconds) until a submitted frame has been presented, or has finished rendering when
+	// ..present times aren't available (presented says which). Not for use between AcquireNextBuffer and BeginRenderPresent.
+	bool WaitForFrame(uint64_t frame, uint64_t timeout, bool * presented = nullptr);
 
+	// ..Builds a pipeline (using the renderer's rasterizer, multisampler and viewports) and stores it in pipelines[name]
+	vk::Pipeline CreateGraphicsPipeline(string name, const GraphicsPipelineInfo & info);
+	// ..Returns the pipeline made from pipelines[name] with the given constants set for each stage (on top of the
+	// ..stage's own), building it the first time. Variants live in pipelines[] under their key, so they reload like any other.
+	vk::Pipeline GetPipelineVariant(string name, const map<vk::ShaderStageFlagBits, SpecializationConstants> & stage_constants);
+	// ..Returns the pipeline made from pipelines[name] for another render pass and subpass (a frame graph pass's, for
+	// ..example: frame_graph->CurrentRenderPass() and CurrentSubpass()), building it the first time
+	vk::Pipeline GetPassPipeline(string name, vk::RenderPass render_pass, uint32_t subpass);
+	// ..The same for dynamic rendering, into attachments of these formats (eUndefined for no depth)
+	vk::Pipeline GetRenderingPipeline(string name, const vector<vk::Format> & color_formats, vk::Format depth_format);
+	// ..Whether passes render without render pass and framebuffer objects (VK_KHR_dynamic_rendering)
+	bool UsesDynamicRendering() const { return dynamic_rendering_active; }
+	// ..Rebuilds the pipelines that use any of the given .spv files, the old ones are destroyed once no frame in flight uses them
+	void ReloadShaders(const vector<string> & shader_files);
+	// ..Returns info.layout, or the (shared) layout reflected from the shaders when it's empty
+	// ..(set_layouts, when given, gets the reflected layout's descriptor set layouts, by set number)
+	vk::PipelineLayout GetPipelineLayout(const GraphicsPipelineInfo & info, vector<vk::DescriptorSetLayout> * set_layouts = nullptr);
 	void DestroyPipelines();
 
+	//Compute
+	// ..Builds a compute pipeline from a .comp (or .spv) shader and stores it in pipelines[name], it reloads and takes
+	// ..variants like the graphics ones
+	vk::Pipeline CreateComputePipeline(string name, const ShaderStage & shader);
+	// ..Binds pipelines[name] and the bindings (in a descriptor set that lasts until the frame is done), pushes the
+	// ..constants, and dispatches the groups. Only between BeginScene and EndScene (in a frame graph pass).
+	void Dispatch(vk::CommandBuffer command_buffer, string name, const vector<DescriptorBinding> & bindings,
+				  uint32_t groups_x, uint32_t groups_y, uint32_t groups_z = 1, const void * push_constants = nullptr, uint32_t push_constant_size = 0);
+
+	//Presenting
+	// ..Switches policies (recreating the swapchain if the present mode changes), VK_PRESENT_POLICY sets the first one
+	void SetPresentPolicy(PresentPolicy policy);
+	PresentPolicy GetPresentPolicy() const { return present_policy; }
+	// ..The present mode the swapchain was created with
+	vk::PresentModeKHR GetPresentMode() const { return present_mode; }
+	// ..Switches policies (recreating the swapchain, and rebuilding the pipelines, if the format changes),
+	// ..VK_SURFACE_FORMAT sets the first one
+	void SetSurfaceFormatPolicy(SurfaceFormatPolicy policy);
+	SurfaceFormatPolicy GetSurfaceFormatPolicy() const { return surface_format_policy; }
+	vk::SurfaceFormatKHR GetSurfaceFormat() const { return surface_format; }
+	float hdr10_paper_white = 203.0f; // nits the scene's 1.0 is shown at on an HDR10 swapchain (BT.2408's reference white)
+
+	//Multisampling
+	// ..Sets the scene's sample count (lowered to what the device can do), rebuilding the pipelines if it changes.
+	// ..VK_MSAA sets the first one
+	void SetSampleCount(vk::SampleCountFlagBits samples);
+	vk::SampleCountFlagBits GetSampleCount() const { return msaa_samples; }
+
+	//Scene Format
+	// ..Draws the scene in another format than the swapchain's (an HDR one, for post processing), rebuilding the pipelines.
+	// ..Only with the scene target (dynamic resolution), the scene is blitted into the swapchain image. Returns false,
+	// ..changing nothing, when the device can't draw, sample and blit the format. eUndefined goes back to the swapchain's.
+	bool SetSceneFormat(vk::Format format);
+	vk::Format GetSceneFormat() const;
+
+	//Render Pass and Framebuffer Caches
+	// ..Returns the render pass made from these descriptions, creating it the first time. Render passes last until shutdown.
+	vk::RenderPass GetRenderPass(const vector<vk::AttachmentDescription> & attachments, const vector<vk::SubpassDescription> & subpasses,
+								 const vector<vk::SubpassDependency> & dependencies);
+	// ..Returns the framebuffer for the render pass and views, creating it the first time. It's destroyed after going unused
+	// ..for a while, or once the frames in flight are done with it after EvictFramebuffers is given one of its views.
+	vk::Framebuffer GetFramebuffer(vk::RenderPass pass, const vector<vk::ImageView> & views, vk::Extent2D extent);
+	// ..Call before destroying image views, so no framebuffer is left pointing at them (handles get reused)
+	void EvictFramebuffers(const vector<vk::ImageView> & views);
+
+	//Deferred Deletion
+	// ..Runs destroy once every frame submitted so far has finished (right away if none are in flight),
+	// ..for objects the GPU may still be using. With recording, the frame being recorded has to finish too.
+	void Retire(function<void()> destroy, bool recording = false);
+
 	//Resizing
+	// ..The old swapchain and everything drawn into it are retired, not destroyed, so neither of these waits for the GPU
 	void ResizeSwapchain();
 	void RecreateSwapchain();
 	int ResizeViewports(int width, int height, int i = -1);
@@ -87,57 +335,101 @@ class VkRenderer
 
   private:
 	//__Variables__
-	int required_i_extensions = 1;
-	int required_d_extensions = 2;
-	int supported_d_extensions = 0;
 	vk::DispatchLoaderDynamic dl;
 	VkResult res;
 	map<string, vk::ShaderModule> shader_cache;
+	ShaderArchive shader_archive;
+	bool reloading_shaders = false; // ..shader errors are only logged then, the old pipelines keep running
+	vk::PipelineCache pipeline_cache = nullptr;
+	string pipeline_cache_file;
 	vk::UniqueInstance instance;
 	VkSurfaceKHR surface;
-	bool present_mode_set = true;
-	vk::PresentModeKHR present_mode = vk::PresentModeKHR::eImmediate;
+	PresentPolicy present_policy = PresentPolicy::LowestLatency;
+	vk::PresentModeKHR present_mode = vk::PresentModeKHR::eFifo;
 	vk::SurfaceCapabilitiesKHR surface_caps;
+	SurfaceFormatPolicy surface_format_policy = SurfaceFormatPolicy::SRGB;
 	vk::SurfaceFormatKHR surface_format;
+	vk::SampleCountFlagBits msaa_samples = vk::SampleCountFlagBits::e1;
+	vk::Format scene_format = vk::Format::eUndefined; // undefined draws in the swapchain's format
+	bool dynamic_rendering_active = false;
 	vk::PhysicalDevice gpu;
 	vk::DeviceMemory device_memory;
 	vector<uint32_t> queue_family_indices;
 	vk::SwapchainKHR swapchain;
 	vk::SwapchainKHR old_swapchain = nullptr;
+	uint64_t swapchain_first_frame = 1; // present ids restart with each swapchain, earlier frames went to an older one
 	vector<vk::ImageView> swapchain_buffer_view{};
-	vk::Image depth_stencil_buffer;
-	vk::ImageView depth_stencil_buffer_view;
 	vk::Format depth_buffer_format = vk::Format::eUndefined;
 	bool stencil_support = false;
 	vector<const char *> device_extensions{};
 	vector<const char *> instance_layers{};
 	vector<const char *> instance_extensions{};
-	vma::Allocation depth_buffer_allocation;
-	vk::DispatchLoaderDynamic dldid;
+	//Scene Target (dynamic resolution)
+	bool scene_target_active = false;
+	vk::Extent2D scene_extent;                      // the size the scene's color and depth are allocated at
+	vk::QueryPool timestamp_queries = nullptr;      // a begin and end timestamp for each buffer
+	vector<bool> timestamps_written;
+	uint64_t timestamp_mask = 0;                    // the bits the graphics queue's timestamps have, 0 without timestamps
+	int scale_frames = 0;                           // frames since the scale last moved
+	vector<uint64_t> fence_frames;                      // the last frame submitted with each of the wait_fences
+	vector<pair<uint64_t, function<void()>>> retired_objects; // (last frame that could use it, destroys it), in retiring order
+	map<string, vk::DescriptorSetLayout> descriptor_set_layouts; // keyed by their bindings, so identical layouts are shared
+	map<string, vk::PipelineLayout> pipeline_layouts;            // keyed by their set layouts and push constant ranges
+	map<string, vk::RenderPass> render_passes;                   // keyed by their attachments, subpasses and dependencies
+	set<string> target_pipelines;                                // pipelines[] made for a pass's render pass or formats
+	vector<vector<vk::DescriptorPool>> descriptor_pools;         // by buffer, reset when the buffer's frame begins again
+	uint32_t current_buffer = 0;                                 // ..the buffer being recorded
+	vk::Sampler linear_sampler = nullptr;                        // for combined image samplers bound by Dispatch
+	struct CachedFramebuffer {
+		vk::Framebuffer framebuffer;
+		vector<vk::ImageView> views;
+		uint64_t last_used;
+	};
+	map<string, CachedFramebuffer> framebuffers;                 // keyed by render pass, extent and views
 
 	//Functions
 	void GetSDLWindowInfo(SDL_Window *window);
+	void ShaderError(string reason, string filename);
+	void SavePipelineCache();
 	void GetExtraInstanceExtensions();
 	void InitInstance();
 	void DestroyInstance();
 	int GetExtraDeviceExtensions(vk::PhysicalDevice * gpu);
+	bool DeviceExtensionUsable(const CapabilityEntry & entry, const set<string> & supported);
+	void NegotiateDeviceExtensions();
+	uint64_t ScoreDevice(vk::PhysicalDevice device_option);
+	string DeviceUUID(vk::PhysicalDevice device_option);
 	void CreateDeviceContext();
 	void DestroyDeviceContext();
 	void CreateSurface(SDL_Window *window);
 	void DestroySurface();
+	vk::PresentModeKHR ChoosePresentMode(PresentPolicy policy);
+	vk::SurfaceFormatKHR ChooseSurfaceFormat(SurfaceFormatPolicy policy);
+	vk::SampleCountFlagBits SupportedSampleCount(vk::SampleCountFlagBits samples);
 	void CreateSwapchain();
 	void DestroySwapchain();
 	void CreateSwapchainImages();
 	void DestroySwapchainImages();
-	void CreateDepthStencilImage();
-	void DestroyDepthStencilImage();
+	void ChooseDepthFormat();
 	void CreateRenderpass();
-	void DestroyRenderpass();
-	void CreateFramebuffers();
+	void DestroyRenderPasses();
 	void DestroyFramebuffers();
+	void EvictIdleFramebuffers();
+	bool SceneTargetSupported(vk::Format format); // ..for a swapchain in format
+	void SizeSceneTarget();
+	void ReadFrameTime(uint32_t buf_num);
+	vk::Extent2D ScaledExtent();
 
 	void CreateSynchronizations();
 	void DestroySynchronizations();
+	bool FrameRetired(uint64_t frame);
+
+	vk::Pipeline BuildPipeline(const GraphicsPipelineInfo & info);
+	void RebuildPipelines();
+	void RenderingFormats(const GraphicsPipelineInfo & info, vector<vk::Format> & color_formats, vk::Format & depth_format);
+	void DestroyRetiredObjects(bool all = false);
+	vk::DescriptorSet AllocateDescriptorSet(vk::DescriptorSetLayout layout);
+	void DestroyDescriptorPools();
 
 	
 #ifdef VK_DEBUG
@@ -179,20 +471,55 @@ struct Vertex {
 	}
 };
 
+//Buffer Upload
+// Copies recorded into one command buffer, instead of each being submitted and waited on. Data is staged in
+// [staging_offset, staging_limit) of staging_buffer (a mapped ring its owner hands out) while it fits, and in staging
+// buffers of its own after that. The owner submits command_buffer, and calls Release once its fence has signaled.
+struct BufferUpload {
+	vk::CommandBuffer command_buffer;
+	vk::Buffer staging_buffer;
+	uint8_t * staging_data = nullptr;
+	vk::DeviceSize staging_offset = 0; // ..moves up as data is staged
+	vk::DeviceSize staging_limit = 0;
+	vector<function<void()>> releases; // what the copies read from, that isn't the ring
+
+	void Release(){
+		for (auto & release : releases){ release(); }
+		releases.clear();
+	}
+};
+
 //Vertex Buffer
 class VertexBuffer{
 	public:
 		vk::Buffer vertex_buffer;
-		vector<Vertex> verex_info;
+		vk::Buffer index_buffer = nullptr;
+		uint32_t vertex_count = 0;
+		uint32_t index_count = 0;
+		vk::IndexType index_type = vk::IndexType::eUint16;
 		vma::Allocator * allocator;
 		VkPhysicalDeviceProperties gpu_properties;
+		const DeviceDispatch * dispatch;
 
-		VertexBuffer(vector<Vertex>, VkRenderer *);
+		// ..With an upload, the copies are only recorded into it (see below)
+		VertexBuffer(const vector<Vertex> &, VkRenderer *, BufferUpload * upload = nullptr);
+		VertexBuffer(const vector<Vertex> &, const vector<uint32_t> & indices, VkRenderer *, BufferUpload * upload = nullptr);
+		// ..Uploads the vertex (and index) streams straight out of the file mapping. With an upload, the copies are only
+		// ..recorded into it: the buffers can't be drawn (and the mesh has to stay mapped) until they've run.
+		VertexBuffer(const MeshFile &, VkRenderer *, BufferUpload * upload = nullptr);
 		~VertexBuffer();
+
+		// ..Binds the buffers and records the draw (indexed if the mesh has indices)
+		void Draw(vk::CommandBuffer command_buffer, uint32_t instance_count = 1);
+		// ..Overwrites part of the vertex stream (offset and size in bytes) with a copy recorded into the upload, so it runs
+		// ..after the frames in flight. The caller puts barriers around it, against those frames' reads and the next draw's.
+		void Write(VkRenderer *, const void * vertices, vk::DeviceSize offset, vk::DeviceSize size, BufferUpload & upload);
 	private:
-		vk::BufferCreateInfo buffer_info = {};
-		vma::Allocation buffer_memory;
-		vk::BufferCreateInfo staging_buffer_info = {};
-		vk::Buffer staging_buffer = nullptr;
-		vma::Allocation staged_memory = nullptr;
+		vma::Allocation buffer_memory = nullptr;
+		vma::Allocation index_memory = nullptr;
+
+		void UploadBuffer(VkRenderer *, const void * data, vk::DeviceSize size, vk::BufferUsageFlags usage,
+						  vk::Buffer & buffer, vma::Allocation & memory, const MeshFile * source = nullptr, BufferUpload * upload = nullptr);
+		void CopyToBuffer(VkRenderer *, const void * data, vk::DeviceSize size, vk::Buffer buffer, vma::Allocation memory,
+						  vk::DeviceSize offset, const MeshFile * source = nullptr, BufferUpload * upload = nullptr);
 };
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "shader_archive.h"
+#include <SDL2/SDL.h>
+#include <cstring>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+ShaderArchive::~ShaderArchive()
+{
+	Unmap();
+}
+
+bool ShaderArchive::Open(string filename)
+{
+	Unmap();
+#ifdef _WIN32
+	file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE){
+		file_handle = nullptr;
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file_handle, &file_size);
+	mapping_size = size_t(file_size.QuadPart);
+	if (mapping_size >= sizeof(ShaderArchiveHeader)){
+		map_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map_handle){
+			mapping = static_cast<const uint8_t *>(MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0));
+		}
+	}
+#else
+	file_descriptor = open(filename.c_str(), O_RDONLY);
+	if (file_descriptor < 0){
+		return false;
+	}
+	struct stat file_info;
+	fstat(file_descriptor, &file_info);
+	mapping_size = size_t(file_info.st_size);
+	if (mapping_size >= sizeof(ShaderArchiveHeader)){
+		void * address = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+		if (address != MAP_FAILED){
+			mapping = static_cast<const uint8_t *>(address);
+		}
+	}
+#endif
+	if (!mapping){
+		Unmap();
+		return false;
+	}
+
+	// Every slot has to point inside the file, so Find never has to check bounds
+	header = *reinterpret_cast<const ShaderArchiveHeader *>(mapping);
+	bool valid = header.magic == SHADER_ARCHIVE_MAGIC && header.version == SHADER_ARCHIVE_VERSION &&
+		header.slot_count && !(header.slot_count & (header.slot_count - 1)) &&
+		sizeof(ShaderArchiveHeader) + uint64_t(header.slot_count) * sizeof(ShaderArchiveSlot) <= mapping_size;
+	for (uint32_t i = 0; valid && i < header.slot_count; i++){
+		auto & slot = reinterpret_cast<const ShaderArchiveSlot *>(mapping + sizeof(ShaderArchiveHeader))[i];
+		valid = !slot.id_hash || (
+			uint64_t(slot.id_offset) + slot.id_size <= mapping_size &&
+			uint64_t(slot.code_offset) + slot.code_size <= mapping_size &&
+			slot.code_offset % SHADER_ARCHIVE_ALIGNMENT == 0 && slot.code_size % sizeof(uint32_t) == 0);
+	}
+	if (!valid){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Ignoring shader archive %s (corrupted, or packed by a different version)", filename.c_str());
+		Unmap();
+		return false;
+	}
+	return true;
+}
+
+const uint32_t * ShaderArchive::Find(const string & id, size_t & word_count) const
+{
+	if (!mapping){ return nullptr; }
+	uint64_t hash = ShaderArchiveHash(id.data(), id.size(), header.seed);
+	auto & slot = reinterpret_cast<const ShaderArchiveSlot *>(mapping + sizeof(ShaderArchiveHeader))[hash & (header.slot_count - 1)];
+	// ..an id that isn't in the archive lands on some other shader's slot (or an empty one)
+	if (slot.id_hash != hash || slot.id_size != id.size() || memcmp(mapping + slot.id_offset, id.data(), id.size()) != 0){
+		return nullptr;
+	}
+	word_count = slot.code_size / sizeof(uint32_t);
+	return reinterpret_cast<const uint32_t *>(mapping + slot.code_offset);
+}
+
+void ShaderArchive::Unmap()
+{
+#ifdef _WIN32
+	if (mapping){ UnmapViewOfFile(mapping); }
+	if (map_handle){ CloseHandle(map_handle); }
+	if (file_handle){ CloseHandle(file_handle); }
+	map_handle = nullptr;
+	file_handle = nullptr;
+#else
+	if (mapping){ munmap(const_cast<uint8_t *>(mapping), mapping_size); }
+	if (file_descriptor >= 0){ close(file_descriptor); }
+	file_descriptor = -1;
+#endif
+	mapping = nullptr;
+	mapping_size = 0;
+}
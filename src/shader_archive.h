@@ -0,0 +1,68 @@
+#pragma once
+// Packed shader archive (shaders.pak)
+// All of the compiled SPIR-V in one file, so startup maps a single file instead of opening every shader.
+// The layout is: a fixed header, a table of slot_count slots, the shader ids, then the SPIR-V blobs (each
+// starting on a SHADER_ARCHIVE_ALIGNMENT boundary, so they can be handed to Vulkan in place).
+// The slot of an id is ShaderArchiveHash(id, seed) & (slot_count - 1), and the packer picks a seed that
+// gives every shader its own slot, so a lookup is one hash and one compare.
+// Archives are produced by tools/shader_pack.cpp (see VkPackShaders.sh).
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#define SHADER_ARCHIVE_MAGIC 0x31505356 // "VSP1" read as a little endian integer
+#define SHADER_ARCHIVE_VERSION 1
+#define SHADER_ARCHIVE_ALIGNMENT 4     // SPIR-V is read as 32 bit words
+
+struct ShaderArchiveHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t seed;       // perfect hash seed
+	uint32_t slot_count; // a power of two
+};
+static_assert(sizeof(ShaderArchiveHeader) == 16, "ShaderArchiveHeader is written to disk, its size can't change");
+
+struct ShaderArchiveSlot {
+	uint64_t id_hash;     // 0 for an empty slot
+	uint32_t id_offset;   // byte offset of the id (not null terminated) from the start of the file
+	uint32_t id_size;
+	uint32_t code_offset; // byte offset of the SPIR-V from the start of the file
+	uint32_t code_size;   // in bytes
+};
+static_assert(sizeof(ShaderArchiveSlot) == 24, "ShaderArchiveSlot is written to disk, its size can't change");
+
+// FNV-1a with the seed mixed into the offset basis, never 0 (that marks empty slots)
+inline uint64_t ShaderArchiveHash(const char * id, size_t size, uint32_t seed)
+{
+	uint64_t hash = 14695981039346656037ull ^ (uint64_t(seed) * 0x9E3779B97F4A7C15ull);
+	for (size_t i = 0; i < size; i++){
+		hash ^= uint8_t(id[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash ? hash : 1;
+}
+
+// A shaders.pak file mapped into memory. A missing archive isn't an error, it just has no shaders.
+class ShaderArchive {
+	public:
+		ShaderArchive() {}
+		~ShaderArchive();
+		ShaderArchive(const ShaderArchive &) = delete;
+		ShaderArchive & operator=(const ShaderArchive &) = delete;
+
+		// ..Returns false if there's no (valid) archive at the path
+		bool Open(std::string filename);
+		// ..Returns the SPIR-V packed under the id (the path the shader was loaded from), or nullptr
+		const uint32_t * Find(const std::string & id, size_t & word_count) const;
+	private:
+		const uint8_t * mapping = nullptr;
+		size_t mapping_size = 0;
+		ShaderArchiveHeader header = {};
+#ifdef _WIN32
+		void * file_handle = nullptr;
+		void * map_handle = nullptr;
+#else
+		int file_descriptor = -1;
+#endif
+		void Unmap();
+};
@@ -0,0 +1,248 @@
+#include "shader_compiler.h"
+#include <SDL2/SDL.h>
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#ifdef VK_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+extern char ** environ;
+#endif
+
+using namespace std;
+
+static const char * glsl_extensions[] = {".vert", ".frag", ".comp", ".geom", ".tesc", ".tese"};
+
+static string Extension(string filename)
+{
+	size_t dot = filename.find_last_of('.');
+	return (dot == string::npos) ? "" : filename.substr(dot);
+}
+
+static uint64_t HashString(const string & data, uint64_t hash = 14695981039346656037ull) // FNV-1a
+{
+	for (unsigned char byte : data){
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+ShaderCompiler::ShaderCompiler(string cache_directory) : cache_directory(cache_directory)
+{
+#ifdef _WIN32
+	_mkdir(cache_directory.c_str());
+#else
+	mkdir(cache_directory.c_str(), 0755);
+#endif
+	// Everything about the compiler that changes its output goes into the cache key
+#ifdef VK_SHADERC
+	options = "shaderc vulkan1.0";
+#else
+	options = "glslangValidator vulkan1.0";
+#endif
+#ifdef VK_DEBUG
+	options += " debug-info";
+#else
+	options += " optimize-performance";
+#endif
+}
+
+bool ShaderCompiler::IsGLSL(string filename)
+{
+	string extension = Extension(filename);
+	for (auto glsl_extension : glsl_extensions){
+		if (extension == glsl_extension){ return true; }
+	}
+	return false;
+}
+
+bool ShaderCompiler::ExpandIncludes(string filename, string & output, int depth)
+{
+	ifstream file(filename);
+	if (!file.is_open() || depth > 32){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Can't read shader source %s", filename.c_str());
+		return false;
+	}
+	string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+	string line;
+	while (getline(file, line)){
+		size_t start = line.find_first_not_of(" \t");
+		if (start != string::npos && line.compare(start, 8, "#include") == 0){
+			size_t open_quote = line.find('"', start);
+			size_t close_quote = line.find('"', open_quote + 1);
+			if (open_quote == string::npos || close_quote == string::npos){
+				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Bad #include in %s: %s", filename.c_str(), line.c_str());
+				return false;
+			}
+			if (!ExpandIncludes(directory + line.substr(open_quote + 1, close_quote - open_quote - 1), output, depth + 1)){
+				return false;
+			}
+			continue;
+		}
+		output += line;
+		output += '\n';
+	}
+	return true;
+}
+
+vector<string> ShaderCompiler::IncludedFiles(string filename)
+{
+	vector<string> included;
+	vector<string> unread = {filename};
+	while (!unread.empty() && included.size() < 256){
+		string current = unread.back();
+		unread.pop_back();
+		ifstream file(current);
+		string directory = current.substr(0, current.find_last_of("/\\") + 1);
+		string line;
+		while (getline(file, line)){
+			size_t start = line.find_first_not_of(" \t");
+			if (start == string::npos || line.compare(start, 8, "#include") != 0){ continue; }
+			size_t open_quote = line.find('"', start);
+			size_t close_quote = line.find('"', open_quote + 1);
+			if (open_quote == string::npos || close_quote == string::npos){ continue; }
+			string include = directory + line.substr(open_quote + 1, close_quote - open_quote - 1);
+			if (find(included.begin(), included.end(), include) == included.end()){
+				included.push_back(include);
+				unread.push_back(include);
+			}
+		}
+	}
+	return included;
+}
+
+vector<uint32_t> ShaderCompiler::Compile(string source_file, const ShaderDefines & defines)
+{
+	string source;
+	if (!ExpandIncludes(source_file, source)){
+		return {};
+	}
+
+	string key = options + "\n";
+	for (auto & define : defines){
+		key += define.first + "=" + define.second + "\n";
+	}
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)HashString(source, HashString(key)));
+	string cache_file = cache_directory + hash + Extension(source_file) + ".spv";
+
+	ifstream cached(cache_file, ios::ate | ios::binary);
+	if (!cached.is_open()){
+		if (!CompileToFile(source_file, source, defines, cache_file)){
+			return {};
+		}
+		cached.open(cache_file, ios::ate | ios::binary);
+	}
+
+	vector<uint32_t> spirv(size_t(cached.tellg()) / sizeof(uint32_t));
+	cached.seekg(0, ios::beg);
+	cached.read(reinterpret_cast<char *>(spirv.data()), spirv.size() * sizeof(uint32_t));
+	return spirv;
+}
+
+bool ShaderCompiler::CompileToFile(string source_file, const string & source, const ShaderDefines & defines, string output_file)
+{
+	// Output goes to a temporary file first, so a parallel or interrupted compile never leaves half a cache entry
+	string temporary_file = output_file + ".tmp" + to_string(hash<thread::id>()(this_thread::get_id()));
+#ifdef VK_SHADERC
+	static const shaderc_shader_kind kinds[] = {
+		shaderc_glsl_vertex_shader, shaderc_glsl_fragment_shader, shaderc_glsl_compute_shader,
+		shaderc_glsl_geometry_shader, shaderc_glsl_tess_control_shader, shaderc_glsl_tess_evaluation_shader};
+	shaderc_shader_kind kind = shaderc_glsl_infer_from_source;
+	for (int i = 0; i < 6; i++){
+		if (Extension(source_file) == glsl_extensions[i]){ kind = kinds[i]; }
+	}
+
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions compile_options;
+	compile_options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+#ifdef VK_DEBUG
+	compile_options.SetGenerateDebugInfo();
+#else
+	compile_options.SetOptimizationLevel(shaderc_optimization_level_performance);
+#endif
+	for (auto & define : defines){
+		compile_options.AddMacroDefinition(define.first, define.second);
+	}
+
+	auto result = compiler.CompileGlslToSpv(source, kind, source_file.c_str(), compile_options);
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "%s", result.GetErrorMessage().c_str());
+		return false;
+	}
+	ofstream output(temporary_file, ios::binary);
+	output.write(reinterpret_cast<const char *>(result.cbegin()), (result.cend() - result.cbegin()) * sizeof(uint32_t));
+	output.close();
+#else
+	// glslangValidator picks the stage from the extension, so the expanded source keeps it
+	string expanded_file = temporary_file + Extension(source_file);
+	{
+		ofstream expanded(expanded_file);
+		expanded << source;
+	}
+	vector<string> arguments = {"glslangValidator", "-V", expanded_file, "-o", temporary_file};
+#ifdef VK_DEBUG
+	arguments.push_back("-g");
+#endif
+	for (auto & define : defines){
+		arguments.push_back("-D" + define.first + "=" + define.second);
+	}
+	vector<char *> argv;
+	for (auto & argument : arguments){ argv.push_back(const_cast<char *>(argument.c_str())); }
+	argv.push_back(nullptr);
+
+	int status = -1;
+#ifdef _WIN32
+	status = int(_spawnvp(_P_WAIT, argv[0], argv.data()));
+#else
+	pid_t compiler;
+	if (posix_spawnp(&compiler, argv[0], nullptr, nullptr, argv.data(), environ) == 0){
+		waitpid(compiler, &status, 0);
+	}
+#endif
+	remove(expanded_file.c_str());
+	if (status != 0){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Shader %s failed to compile (is glslangValidator in PATH?)", source_file.c_str());
+		remove(temporary_file.c_str());
+		return false;
+	}
+#endif
+	// ..another thread may have finished the same variant first, which is just as good
+	if (rename(temporary_file.c_str(), output_file.c_str()) != 0){
+		remove(temporary_file.c_str());
+		return ifstream(output_file).good();
+	}
+	return true;
+}
+
+void ShaderCompiler::Precompile(const vector<ShaderVariant> & variants, unsigned thread_count)
+{
+	if (!thread_count){
+		thread_count = max(1u, thread::hardware_concurrency());
+	}
+	atomic<size_t> next(0);
+	vector<thread> workers;
+	for (unsigned i = 0; i < thread_count && i < variants.size(); i++){
+		workers.push_back(thread([&]{
+			for (size_t v = next++; v < variants.size(); v = next++){
+				Compile(variants[v].source_file, variants[v].defines);
+			}
+		}));
+	}
+	for (auto & worker : workers){
+		worker.join();
+	}
+}
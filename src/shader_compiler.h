@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+// GLSL to SPIR-V compiler stage, used by LoadShaderModule for GLSL paths
+// Compiles in process with shaderc when built with VK_SHADERC, otherwise runs glslangValidator from the Vulkan SDK.
+// Results are cached on disk under a hash of everything that affects the output: the source with its
+// #include files expanded, the defines and the compiler options, so unchanged shaders load straight from the cache.
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
+struct ShaderVariant {
+	std::string source_file;
+	ShaderDefines defines;
+};
+
+class ShaderCompiler {
+	public:
+		ShaderCompiler(std::string cache_directory = "shader_cache/");
+
+		// ..True for the GLSL stage extensions (.vert, .frag, .comp, ...)
+		static bool IsGLSL(std::string filename);
+		// ..Returns the SPIR-V for the shader, compiling it only when it isn't cached. Returns nothing if it fails to compile.
+		std::vector<uint32_t> Compile(std::string source_file, const ShaderDefines & defines = {});
+		// ..Compiles every variant that isn't cached yet, spread over the given number of threads (0 = one per core)
+		void Precompile(const std::vector<ShaderVariant> & variants, unsigned thread_count = 0);
+		// ..The files the source #includes, directly or through other includes (resolved the way compiling resolves them)
+		static std::vector<std::string> IncludedFiles(std::string filename);
+
+	private:
+		std::string cache_directory;
+		std::string options;
+
+		bool ExpandIncludes(std::string filename, std::string & output, int depth = 0);
+		bool CompileToFile(std::string source_file, const std::string & source, const ShaderDefines & defines, std::string output_file);
+};
@@ -0,0 +1,117 @@
+#include "shader_watcher.h"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+ShaderWatcher::ShaderWatcher(string spirv_directory, string source_directory)
+	: spirv_directory(spirv_directory), source_directory(source_directory)
+{
+#ifdef __linux__
+	inotify_descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	stop_descriptor = eventfd(0, EFD_CLOEXEC);
+	if (inotify_descriptor < 0 || stop_descriptor < 0){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Shader hot reload unavailable (inotify)");
+		return;
+	}
+	// Editors and compilers either write the file in place or move a finished one over it
+	uint32_t events = IN_CLOSE_WRITE | IN_MOVED_TO;
+	spirv_watch = inotify_add_watch(inotify_descriptor, spirv_directory.c_str(), events);
+	source_watch = inotify_add_watch(inotify_descriptor, source_directory.c_str(), events);
+	watcher = thread(&ShaderWatcher::Watch, this);
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+#ifdef __linux__
+	if (watcher.joinable()){
+		uint64_t stop = 1;
+		if (write(stop_descriptor, &stop, sizeof(stop)) == sizeof(stop)){
+			watcher.join();
+		}
+		else {
+			watcher.detach();
+		}
+	}
+	if (inotify_descriptor >= 0){ close(inotify_descriptor); }
+	if (stop_descriptor >= 0){ close(stop_descriptor); }
+#endif
+}
+
+vector<string> ShaderWatcher::TakeChanges()
+{
+	lock_guard<mutex> lock(changes_mutex);
+	vector<string> taken;
+	taken.swap(changes);
+	return taken;
+}
+
+void ShaderWatcher::Watch()
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[4096];
+	pollfd descriptors[2] = {{inotify_descriptor, POLLIN, 0}, {stop_descriptor, POLLIN, 0}};
+	while (poll(descriptors, 2, -1) >= 0 && !(descriptors[1].revents & POLLIN)){
+		vector<string> sources;
+		ssize_t length;
+		while ((length = read(inotify_descriptor, buffer, sizeof(buffer))) > 0){
+			for (char * position = buffer; position < buffer + length;){
+				auto event = reinterpret_cast<inotify_event *>(position);
+				position += sizeof(inotify_event) + event->len;
+				if (!event->len){ continue; }
+				string name = event->name;
+
+				// Pipelines built from GLSL reload from their sources, pipelines built from .spv from the file
+				if (event->wd == source_watch){
+					for (auto & source : AffectedSources(name)){
+						if (find(sources.begin(), sources.end(), source) == sources.end()){ sources.push_back(source); }
+					}
+				}
+				else if (event->wd == spirv_watch && name.size() > 4 && name.compare(name.size() - 4, 4, ".spv") == 0){
+					lock_guard<mutex> lock(changes_mutex);
+					string path = spirv_directory + name;
+					if (find(changes.begin(), changes.end(), path) == changes.end()){ changes.push_back(path); }
+				}
+			}
+		}
+		// Saving a file often comes as several events, so each source is only compiled once per wakeup.
+		// ..one that doesn't compile (the errors are logged) keeps its pipelines as they are
+		for (auto & source : sources){
+			if (compiler.Compile(source).empty()){
+				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN, "Shader %s failed to compile", source.c_str());
+				continue;
+			}
+			lock_guard<mutex> lock(changes_mutex);
+			if (find(changes.begin(), changes.end(), source) == changes.end()){ changes.push_back(source); }
+		}
+	}
+#endif
+}
+
+vector<string> ShaderWatcher::AffectedSources(string name)
+{
+	string path = source_directory + name;
+	if (ShaderCompiler::IsGLSL(name)){ return {path}; }
+	vector<string> affected;
+#ifdef __linux__
+	DIR * directory = opendir(source_directory.c_str());
+	if (!directory){ return affected; }
+	while (dirent * entry = readdir(directory)){
+		string source = entry->d_name;
+		if (!ShaderCompiler::IsGLSL(source)){ continue; }
+		source = source_directory + source;
+		auto included = ShaderCompiler::IncludedFiles(source);
+		if (find(included.begin(), included.end(), path) != included.end()){ affected.push_back(source); }
+	}
+	closedir(directory);
+#endif
+	return affected;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include "shader_compiler.h"
+
+// Shader Hot Reload (development builds)
+// Watches the compiled and uncompiled shader directories with inotify. Changed files are collected until the
+// render loop takes them at a frame boundary and hands them to VkRenderer::ReloadShaders:
+//   - .spv files, for pipelines built from them (they're never written here, only reloaded when something else does)
+//   - GLSL sources, compiled through the ShaderCompiler in the background first, so the reload (which compiles
+//     them the same way) finds them in the cache. A changed #include file counts as a change to every source
+//     in the directory that includes it.
+// Only implemented on Linux, elsewhere it never reports changes.
+class ShaderWatcher {
+	public:
+		ShaderWatcher(std::string spirv_directory = "shaders/", std::string source_directory = "uncompiled_shaders/");
+		~ShaderWatcher();
+
+		// ..Returns the shader files that changed since the last call (paths match the ones given to LoadShaderModule)
+		std::vector<std::string> TakeChanges();
+
+	private:
+		std::string spirv_directory;
+		std::string source_directory;
+		std::mutex changes_mutex;
+		std::vector<std::string> changes;
+		std::thread watcher;
+		int inotify_descriptor = -1;
+		int stop_descriptor = -1;
+		int spirv_watch = -1;
+		int source_watch = -1;
+		ShaderCompiler compiler;
+
+		void Watch();
+		// ..The GLSL sources to reload for a changed file in the source directory
+		std::vector<std::string> AffectedSources(std::string name);
+};
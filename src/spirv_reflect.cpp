@@ -0,0 +1,243 @@
+#include "spirv_reflect.h"
+#include <SDL2/SDL.h>
+#include <algorithm>
+
+using namespace std;
+
+// The handful of SPIR-V enumerants needed here (from the SPIR-V specification)
+enum : uint32_t {
+	SPV_MAGIC = 0x07230203,
+	//Opcodes
+	OP_ENTRY_POINT = 15, OP_TYPE_BOOL = 20, OP_TYPE_INT = 21, OP_TYPE_FLOAT = 22, OP_TYPE_VECTOR = 23,
+	OP_TYPE_MATRIX = 24, OP_TYPE_IMAGE = 25, OP_TYPE_SAMPLER = 26, OP_TYPE_SAMPLED_IMAGE = 27, OP_TYPE_ARRAY = 28,
+	OP_TYPE_RUNTIME_ARRAY = 29, OP_TYPE_STRUCT = 30, OP_TYPE_POINTER = 32, OP_CONSTANT = 43, OP_VARIABLE = 59,
+	OP_DECORATE = 71, OP_MEMBER_DECORATE = 72,
+	//Decorations
+	DECORATION_BLOCK = 2, DECORATION_BUFFER_BLOCK = 3, DECORATION_ARRAY_STRIDE = 6, DECORATION_MATRIX_STRIDE = 7,
+	DECORATION_BUILT_IN = 11, DECORATION_LOCATION = 30, DECORATION_BINDING = 33, DECORATION_DESCRIPTOR_SET = 34,
+	DECORATION_OFFSET = 35,
+	//Storage classes
+	STORAGE_UNIFORM_CONSTANT = 0, STORAGE_INPUT = 1, STORAGE_UNIFORM = 2, STORAGE_PUSH_CONSTANT = 9, STORAGE_STORAGE_BUFFER = 12,
+	//Image dimensions
+	DIM_BUFFER = 5, DIM_SUBPASS_DATA = 6,
+};
+
+struct SpirvType {
+	uint32_t opcode = 0;
+	vector<uint32_t> operands; // the instruction's words after the result id
+};
+
+struct SpirvDecorations {
+	map<uint32_t, uint32_t> values;            // decoration -> literal (0 when it has none)
+	map<uint32_t, map<uint32_t, uint32_t>> members; // member -> decoration -> literal
+};
+
+struct SpirvModule {
+	map<uint32_t, SpirvType> types;
+	map<uint32_t, uint32_t> constants;
+	map<uint32_t, SpirvDecorations> decorations;
+
+	bool Decorated(uint32_t id, uint32_t decoration) const {
+		return decorations.count(id) && decorations.at(id).values.count(decoration);
+	}
+	uint32_t Decoration(uint32_t id, uint32_t decoration) const {
+		return Decorated(id, decoration) ? decorations.at(id).values.at(decoration) : 0;
+	}
+	uint32_t MemberDecoration(uint32_t id, uint32_t member, uint32_t decoration) const {
+		if (!decorations.count(id) || !decorations.at(id).members.count(member)){ return 0; }
+		auto & member_decorations = decorations.at(id).members.at(member);
+		return member_decorations.count(decoration) ? member_decorations.at(decoration) : 0;
+	}
+
+	// Byte size of a type as laid out in a push constant block (explicit offsets and strides come from decorations)
+	uint32_t Size(uint32_t type_id, uint32_t matrix_stride = 0) const {
+		if (!types.count(type_id)){ return 0; }
+		const SpirvType & type = types.at(type_id);
+		switch (type.opcode){
+			case OP_TYPE_BOOL: return 4;
+			case OP_TYPE_INT:
+			case OP_TYPE_FLOAT: return type.operands[0] / 8;
+			case OP_TYPE_VECTOR: return type.operands[1] * Size(type.operands[0]);
+			case OP_TYPE_MATRIX: return type.operands[1] * (matrix_stride ? matrix_stride : Size(type.operands[0]));
+			case OP_TYPE_ARRAY: {
+				uint32_t stride = Decoration(type_id, DECORATION_ARRAY_STRIDE);
+				return constants.count(type.operands[1]) ? constants.at(type.operands[1]) * (stride ? stride : Size(type.operands[0])) : 0;
+			}
+			case OP_TYPE_STRUCT: {
+				uint32_t size = 0;
+				for (uint32_t member = 0; member < type.operands.size(); member++){
+					uint32_t end = MemberDecoration(type_id, member, DECORATION_OFFSET) +
+						Size(type.operands[member], MemberDecoration(type_id, member, DECORATION_MATRIX_STRIDE));
+					size = max(size, end);
+				}
+				return size;
+			}
+			default: return 0;
+		}
+	}
+
+	vk::Format Format(uint32_t type_id) const {
+		if (!types.count(type_id)){ return vk::Format::eUndefined; }
+		const SpirvType & type = types.at(type_id);
+		uint32_t components = 1;
+		const SpirvType * scalar = &type;
+		if (type.opcode == OP_TYPE_VECTOR){
+			components = type.operands[1];
+			if (!types.count(type.operands[0])){ return vk::Format::eUndefined; }
+			scalar = &types.at(type.operands[0]);
+		}
+		if (scalar->operands.empty() || scalar->operands[0] != 32 || components < 1 || components > 4){
+			return vk::Format::eUndefined;
+		}
+		static const vk::Format float_formats[] = {vk::Format::eR32Sfloat, vk::Format::eR32G32Sfloat, vk::Format::eR32G32B32Sfloat, vk::Format::eR32G32B32A32Sfloat};
+		static const vk::Format int_formats[] = {vk::Format::eR32Sint, vk::Format::eR32G32Sint, vk::Format::eR32G32B32Sint, vk::Format::eR32G32B32A32Sint};
+		static const vk::Format uint_formats[] = {vk::Format::eR32Uint, vk::Format::eR32G32Uint, vk::Format::eR32G32B32Uint, vk::Format::eR32G32B32A32Uint};
+		if (scalar->opcode == OP_TYPE_FLOAT){ return float_formats[components - 1]; }
+		if (scalar->opcode == OP_TYPE_INT){ return scalar->operands[1] ? int_formats[components - 1] : uint_formats[components - 1]; }
+		return vk::Format::eUndefined;
+	}
+};
+
+bool ShaderReflection::Parse(const uint32_t * code, size_t word_count)
+{
+	*this = ShaderReflection();
+	if (word_count < 5 || code[0] != SPV_MAGIC){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Shader code isn't SPIR-V");
+		return false;
+	}
+
+	struct Variable { uint32_t id, pointer_type, storage; };
+	SpirvModule module;
+	vector<Variable> variables;
+	map<uint32_t, pair<uint32_t, uint32_t>> pointers; // pointer type -> (storage class, pointee type)
+	bool entry_point_found = false;
+
+	for (size_t i = 5; i < word_count;){
+		uint32_t opcode = code[i] & 0xFFFF;
+		uint32_t length = code[i] >> 16;
+		if (length == 0 || i + length > word_count){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Shader code is truncated");
+			*this = ShaderReflection();
+			return false;
+		}
+		const uint32_t * words = code + i;
+		switch (opcode){
+			case OP_ENTRY_POINT:
+				if (!entry_point_found){
+					static const vk::ShaderStageFlagBits stages[] = {
+						vk::ShaderStageFlagBits::eVertex, vk::ShaderStageFlagBits::eTessellationControl,
+						vk::ShaderStageFlagBits::eTessellationEvaluation, vk::ShaderStageFlagBits::eGeometry,
+						vk::ShaderStageFlagBits::eFragment, vk::ShaderStageFlagBits::eCompute};
+					if (words[1] < 6){ stage = stages[words[1]]; }
+					entry_point_found = true;
+				}
+				break;
+			case OP_TYPE_BOOL: case OP_TYPE_INT: case OP_TYPE_FLOAT: case OP_TYPE_VECTOR: case OP_TYPE_MATRIX:
+			case OP_TYPE_IMAGE: case OP_TYPE_SAMPLER: case OP_TYPE_SAMPLED_IMAGE: case OP_TYPE_ARRAY:
+			case OP_TYPE_RUNTIME_ARRAY: case OP_TYPE_STRUCT: {
+				SpirvType & type = module.types[words[1]];
+				type.opcode = opcode;
+				type.operands.assign(words + 2, words + length);
+				break;
+			}
+			case OP_TYPE_POINTER:
+				pointers[words[1]] = {words[2], words[3]};
+				break;
+			case OP_CONSTANT:
+				if (length >= 4){ module.constants[words[2]] = words[3]; }
+				break;
+			case OP_VARIABLE:
+				variables.push_back({words[2], words[1], words[3]});
+				break;
+			case OP_DECORATE:
+				module.decorations[words[1]].values[words[2]] = (length > 3) ? words[3] : 0;
+				break;
+			case OP_MEMBER_DECORATE:
+				module.decorations[words[1]].members[words[2]][words[3]] = (length > 4) ? words[4] : 0;
+				break;
+		}
+		i += length;
+	}
+
+	for (auto & variable : variables){
+		if (!pointers.count(variable.pointer_type)){ continue; }
+		uint32_t type_id = pointers[variable.pointer_type].second;
+
+		if (variable.storage == STORAGE_INPUT){
+			// built ins (gl_VertexIndex, gl_PerVertex, ...) aren't fed by vertex attributes
+			if (module.Decorated(variable.id, DECORATION_BUILT_IN) || !module.Decorated(variable.id, DECORATION_LOCATION)){ continue; }
+			inputs.push_back({module.Decoration(variable.id, DECORATION_LOCATION), module.Format(type_id)});
+		}
+		else if (variable.storage == STORAGE_PUSH_CONSTANT){
+			push_constant_size = max(push_constant_size, module.Size(type_id));
+		}
+		else if (variable.storage == STORAGE_UNIFORM_CONSTANT || variable.storage == STORAGE_UNIFORM || variable.storage == STORAGE_STORAGE_BUFFER){
+			// Arrays of descriptors become one binding with a descriptor count
+			uint32_t count = 1;
+			while (module.types.count(type_id) && module.types[type_id].opcode == OP_TYPE_ARRAY){
+				count *= module.constants.count(module.types[type_id].operands[1]) ? module.constants[module.types[type_id].operands[1]] : 1;
+				type_id = module.types[type_id].operands[0];
+			}
+			if (!module.types.count(type_id)){ continue; }
+			const SpirvType & type = module.types[type_id];
+
+			vk::DescriptorType descriptor_type;
+			if (variable.storage == STORAGE_STORAGE_BUFFER){ descriptor_type = vk::DescriptorType::eStorageBuffer; }
+			else if (variable.storage == STORAGE_UNIFORM){
+				descriptor_type = module.Decorated(type_id, DECORATION_BUFFER_BLOCK) ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eUniformBuffer;
+			}
+			else if (type.opcode == OP_TYPE_SAMPLER){ descriptor_type = vk::DescriptorType::eSampler; }
+			else if (type.opcode == OP_TYPE_SAMPLED_IMAGE){ descriptor_type = vk::DescriptorType::eCombinedImageSampler; }
+			else if (type.opcode == OP_TYPE_IMAGE){
+				uint32_t dimension = type.operands[1], sampled = type.operands[5];
+				if (dimension == DIM_SUBPASS_DATA){ descriptor_type = vk::DescriptorType::eInputAttachment; }
+				else if (dimension == DIM_BUFFER){ descriptor_type = (sampled == 2) ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer; }
+				else { descriptor_type = (sampled == 2) ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage; }
+			}
+			else { continue; }
+
+			descriptor_sets[module.Decoration(variable.id, DECORATION_DESCRIPTOR_SET)].push_back(
+				vk::DescriptorSetLayoutBinding(module.Decoration(variable.id, DECORATION_BINDING), descriptor_type, count, stage));
+		}
+	}
+	return true;
+}
+
+// What a vertex format reads as in the shader: float (normalized, scaled and float formats), signed or unsigned int,
+// and whether it's 64 bit. Component counts don't have to match, missing ones are filled in and extra ones dropped.
+enum class NumericClass { Float, Sint, Uint };
+static NumericClass ClassOf(vk::Format format, bool & wide)
+{
+	string name = vk::to_string(format);
+	wide = name.find("64") != string::npos;
+	if (name.find("Sint") != string::npos){ return NumericClass::Sint; }
+	if (name.find("Uint") != string::npos){ return NumericClass::Uint; }
+	return NumericClass::Float;
+}
+
+static bool Compatible(vk::Format attribute, vk::Format input)
+{
+	bool attribute_wide, input_wide;
+	return ClassOf(attribute, attribute_wide) == ClassOf(input, input_wide) && attribute_wide == input_wide;
+}
+
+bool ShaderReflection::ValidateVertexInput(const vector<vk::VertexInputAttributeDescription> & attributes, string shader_name) const
+{
+	bool valid = true;
+	for (auto & input : inputs){
+		auto attribute = find_if(attributes.begin(), attributes.end(),
+			[&](const vk::VertexInputAttributeDescription & description){ return description.location == input.location; });
+		if (attribute == attributes.end()){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+				"%s reads vertex input location %u, but the pipeline has no attribute for it", shader_name.c_str(), input.location);
+			valid = false;
+		}
+		else if (input.format != vk::Format::eUndefined && !Compatible(attribute->format, input.format)){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+				"%s reads vertex input location %u as %s, but the attribute is %s", shader_name.c_str(), input.location,
+				vk::to_string(input.format).c_str(), vk::to_string(attribute->format).c_str());
+			valid = false;
+		}
+	}
+	return valid;
+}
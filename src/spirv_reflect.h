@@ -0,0 +1,31 @@
+#pragma once
+//Vulkan Header (same configuration as renderer.h)
+#define VULKAN_HPP_NO_EXCEPTIONS
+#define VULKAN_HPP_ASSERT_ON_RESULT
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+
+// SPIR-V Reflection
+// Reads what a shader module expects from the pipeline straight out of its SPIR-V: the stage, the vertex
+// inputs (location and format), the descriptor bindings of every set and the push constant range.
+// Only the first entry point is looked at.
+struct ShaderInput {
+	uint32_t location;
+	vk::Format format;
+};
+
+struct ShaderReflection {
+	vk::ShaderStageFlagBits stage = vk::ShaderStageFlagBits::eVertex;
+	std::vector<ShaderInput> inputs;
+	std::map<uint32_t, std::vector<vk::DescriptorSetLayoutBinding>> descriptor_sets; // set number -> bindings
+	uint32_t push_constant_size = 0;
+
+	// ..Returns false (and leaves the reflection empty) if the code isn't valid SPIR-V
+	bool Parse(const uint32_t * code, size_t word_count);
+	// ..Checks every vertex input has an attribute that reads as its type (float, int or uint, 64 bit or not), logging
+	// ..each mismatch. Returns false on any mismatch.
+	bool ValidateVertexInput(const std::vector<vk::VertexInputAttributeDescription> & attributes, std::string shader_name) const;
+};
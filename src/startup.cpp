@@ -0,0 +1,162 @@
+#include "startup.h"
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <cstdlib>
+
+using namespace std;
+
+mutex StartupTrace::events_mutex;
+vector<StartupTrace::Event> StartupTrace::events;
+uint64_t StartupTrace::origin = 0;
+bool StartupTrace::finished = false;
+
+// Threads are numbered in the order they first record something, the main thread (which calls Start) is 0
+static unsigned ThreadNumber()
+{
+	static atomic<unsigned> next_thread(0);
+	thread_local unsigned number = next_thread++;
+	return number;
+}
+
+StartupTrace::Step::Step(const char * name) : name(name), start(SDL_GetPerformanceCounter()) {}
+
+StartupTrace::Step::~Step()
+{
+	uint64_t end = SDL_GetPerformanceCounter();
+	lock_guard<mutex> lock(events_mutex);
+	if (!finished){
+		events.push_back({name, start, end, ThreadNumber()});
+	}
+}
+
+void StartupTrace::Start()
+{
+	origin = SDL_GetPerformanceCounter();
+	ThreadNumber();
+}
+
+double StartupTrace::Milliseconds(uint64_t ticks)
+{
+	return double(ticks - origin) * 1000.0 / double(SDL_GetPerformanceFrequency());
+}
+
+void StartupTrace::Finish()
+{
+	uint64_t end = SDL_GetPerformanceCounter();
+	lock_guard<mutex> lock(events_mutex);
+	if (finished){ return; }
+	finished = true;
+
+	sort(events.begin(), events.end(), [](const Event & a, const Event & b){ return a.start < b.start; });
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Startup timeline (ms):");
+	for (auto & event : events){
+		SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "  %8.2f - %8.2f  %7.2f  [thread %u] %s",
+			Milliseconds(event.start), Milliseconds(event.end), Milliseconds(event.end) - Milliseconds(event.start), event.thread, event.name.c_str());
+	}
+	SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO, "Time to first frame: %.2f ms", Milliseconds(end));
+
+	const char * trace_file = getenv("VK_STARTUP_TRACE");
+	if (trace_file && *trace_file){
+		// Trace Event Format, timestamps in microseconds
+		ofstream trace(trace_file);
+		trace << "{\"traceEvents\":[\n";
+		for (auto & event : events){
+			trace << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread
+				  << ",\"ts\":" << Milliseconds(event.start) * 1000.0 << ",\"dur\":" << (Milliseconds(event.end) - Milliseconds(event.start)) * 1000.0 << "},\n";
+		}
+		trace << "{\"name\":\"First Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":" << Milliseconds(end) * 1000.0 << "}\n]}\n";
+	}
+	events.clear();
+}
+
+void InitGraph::Add(string name, vector<string> dependencies, function<void()> work, bool main_thread)
+{
+	Node node = {name, {}, work, main_thread, Node::WAITING};
+	for (auto & dependency : dependencies){
+		auto found = find_if(nodes.begin(), nodes.end(), [&](const Node & existing){ return existing.name == dependency; });
+		if (found == nodes.end()){
+			throw logic_error("startup step " + name + " depends on unknown step " + dependency);
+		}
+		node.dependencies.push_back(size_t(found - nodes.begin()));
+	}
+	nodes.push_back(node);
+}
+
+void InitGraph::Run()
+{
+	mutex graph_mutex;
+	condition_variable step_finished;
+	exception_ptr failure;
+	vector<thread> workers;
+	size_t running = 0;
+
+	auto run_step = [&](Node & node){
+		try {
+			StartupTrace::Step step(node.name.c_str());
+			node.work();
+		}
+		catch (...) {
+			lock_guard<mutex> lock(graph_mutex);
+			if (!failure){ failure = current_exception(); }
+		}
+		lock_guard<mutex> lock(graph_mutex);
+		node.state = Node::DONE;
+		running--;
+		step_finished.notify_all();
+	};
+
+	unique_lock<mutex> lock(graph_mutex);
+	for (;;){
+		// Workers are started before a main thread step runs, so they overlap with it
+		Node * main_step = nullptr;
+		bool waiting = false;
+		for (auto & node : nodes){
+			if (node.state != Node::WAITING){ continue; }
+			waiting = true;
+			bool ready = !failure;
+			for (auto dependency : node.dependencies){
+				ready = ready && nodes[dependency].state == Node::DONE;
+			}
+			if (!ready){ continue; }
+			if (node.main_thread){
+				if (!main_step){ main_step = &node; }
+				continue;
+			}
+			node.state = Node::RUNNING;
+			running++;
+			workers.push_back(thread(run_step, ref(node)));
+		}
+
+		if (main_step){
+			main_step->state = Node::RUNNING;
+			running++;
+			lock.unlock();
+			run_step(*main_step);
+			lock.lock();
+		}
+		else if (running){
+			step_finished.wait(lock);
+		}
+		else {
+			// ..nothing running and nothing can start: either everything ran, or a step failed
+			if (waiting && !failure){
+				failure = make_exception_ptr(logic_error("startup steps can't all run"));
+			}
+			break;
+		}
+	}
+	lock.unlock();
+
+	for (auto & worker : workers){
+		worker.join();
+	}
+	if (failure){
+		rethrow_exception(failure);
+	}
+}
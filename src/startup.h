@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+
+// Startup Tracing
+// Records when every initialization step ran (and on which thread) until the first frame is presented,
+// then logs the timeline. Setting VK_STARTUP_TRACE=<file> also writes it as a chrome://tracing file.
+class StartupTrace {
+	public:
+		// ..Times the enclosing scope as one step
+		class Step {
+			public:
+				Step(const char * name);
+				~Step();
+			private:
+				const char * name;
+				uint64_t start;
+		};
+
+		// ..Marks the start of the timeline, call it first thing in main
+		static void Start();
+		// ..Ends the timeline (at the first presented frame) and reports it, later steps aren't recorded
+		static void Finish();
+	private:
+		struct Event {
+			std::string name;
+			uint64_t start, end;
+			unsigned thread;
+		};
+		static std::mutex events_mutex;
+		static std::vector<Event> events;
+		static uint64_t origin;
+		static bool finished;
+
+		static double Milliseconds(uint64_t ticks);
+};
+
+// Initialization Graph
+// Runs startup steps in dependency order, each one as soon as everything it needs has finished. Steps run
+// on their own threads unless they're marked main_thread (SDL window calls, for example), and each one
+// shows up in the startup trace.
+class InitGraph {
+	public:
+		// ..A step may only depend on steps added before it
+		void Add(std::string name, std::vector<std::string> dependencies, std::function<void()> work, bool main_thread = false);
+		// ..Runs every step. If one throws, nothing new starts, and the exception is rethrown once the running steps finish.
+		void Run();
+	private:
+		struct Node {
+			std::string name;
+			std::vector<size_t> dependencies;
+			std::function<void()> work;
+			bool main_thread;
+			enum { WAITING, RUNNING, DONE } state;
+		};
+		std::vector<Node> nodes;
+};
@@ -0,0 +1,321 @@
+#include "streaming.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef VK_IO_URING
+#include <liburing.h>
+#endif
+
+#define IO_BATCH_SIZE 32
+
+AssetStreamer::AssetStreamer(VkRenderer * renderer, uint64_t vram_budget, uint64_t upload_budget, int decode_threads)
+	: vram_budget(vram_budget), upload_budget(upload_budget), renderer(renderer)
+{
+	// Discrete GPUs copy through staging memory (integrated ones write straight into the buffers). The ring holds two
+	// frames of uploads, one in flight while the next is recorded, bigger meshes get staging buffers of their own.
+	if (renderer->gpu_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU){
+		auto ring_info = vk::BufferCreateInfo(vk::BufferCreateFlags(), upload_budget * 2, vk::BufferUsageFlagBits::eTransferSrc);
+		vma::AllocationCreateInfo ring_alloc_info;
+		ring_alloc_info.setUsage(vma::MemoryUsage::eCpuOnly);
+		ring_alloc_info.setFlags(vma::AllocationCreateFlagBits::eMapped);
+		vma::AllocationInfo ring_allocation;
+		tie(staging_ring, staging_memory) = renderer->gpu_allocator.createBuffer(ring_info, ring_alloc_info, ring_allocation).value;
+		if (staging_ring){
+			staging_data = static_cast<uint8_t *>(ring_allocation.pMappedData);
+			staging_size = upload_budget * 2;
+		}
+	}
+
+	threads.push_back(thread(&AssetStreamer::IOThread, this));
+	for (int i = 0; i < decode_threads; i++){
+		threads.push_back(thread(&AssetStreamer::DecodeThread, this));
+	}
+}
+
+AssetStreamer::~AssetStreamer()
+{
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	io_signal.notify_all();
+	decode_signal.notify_all();
+	for (auto & worker : threads){
+		worker.join();
+	}
+	// the device has to be idle by now, same as when deleting any other VertexBuffer
+	for (auto & asset : assets){
+		delete asset.buffer;
+	}
+	for (auto & pending : uploads){
+		for (auto & entry : pending.buffers){
+			delete entry.second;
+		}
+		pending.upload.Release();
+		renderer->device->freeCommandBuffers(renderer->command_pool, pending.upload.command_buffer);
+		renderer->device->destroyFence(pending.fence);
+	}
+	if (staging_ring){
+		renderer->gpu_allocator.destroyBuffer(staging_ring, staging_memory);
+	}
+}
+
+AssetHandle AssetStreamer::Request(string path, int priority)
+{
+	if (asset_handles.count(path)){
+		AssetHandle handle = asset_handles[path];
+		assets[handle].priority = max(assets[handle].priority, priority);
+		return handle;
+	}
+	AssetHandle handle = assets.size();
+	Asset asset;
+	asset.path = path;
+	asset.priority = priority;
+	assets.push_back(asset);
+	asset_handles[path] = handle;
+	Enqueue(handle);
+	return handle;
+}
+
+VertexBuffer * AssetStreamer::Get(AssetHandle handle)
+{
+	Asset & asset = assets[handle];
+	if (!asset.buffer){
+		if (!asset.queued && !asset.failed){
+			Enqueue(handle);
+		}
+		return nullptr;
+	}
+	asset.last_drawn = renderer->frame_count + 1; // ..the frame being recorded
+	residency.splice(residency.begin(), residency, asset.lru);
+	return asset.buffer;
+}
+
+void AssetStreamer::Enqueue(AssetHandle handle)
+{
+	assets[handle].queued = true;
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		io_queue.push(LoadRequest{assets[handle].priority, request_count++, handle, assets[handle].path, nullptr});
+	}
+	io_signal.notify_one();
+}
+
+void AssetStreamer::Update()
+{
+	FinishUploads();
+
+	// Ring space for this frame's copies: from the head up to the tail, or up to the end (wrapping around to the
+	// start when the space before the tail is bigger). Uploads that staged nothing in it don't hold any.
+	bool ring_empty = all_of(uploads.begin(), uploads.end(), [](const PendingUpload & pending){ return pending.staging_start == pending.staging_end; });
+	if (ring_empty){
+		staging_head = staging_tail = 0;
+	}
+	PendingUpload pending;
+	pending.upload.staging_buffer = staging_ring;
+	pending.upload.staging_data = staging_data;
+	pending.upload.staging_offset = staging_head;
+	pending.upload.staging_limit = ring_empty ? staging_size : staging_tail;
+	if (!ring_empty && staging_head > staging_tail){
+		bool wrap = staging_size - staging_head < staging_tail;
+		pending.upload.staging_offset = wrap ? 0 : staging_head;
+		pending.upload.staging_limit = wrap ? staging_tail : staging_size;
+	}
+	pending.staging_start = pending.upload.staging_offset;
+
+	// Record the copies for finished loads, highest priority first, until the per frame budget is used up
+	bool recording = false;
+	uint64_t uploaded = 0;
+	while (uploaded < upload_budget){
+		LoadRequest request;
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			if (ready_queue.empty()){ break; }
+			request = ready_queue.top();
+			ready_queue.pop();
+		}
+		Asset & asset = assets[request.handle];
+		if (!request.mesh){
+			asset.queued = false;
+			asset.failed = true;
+			continue;
+		}
+		if (!recording){
+			pending.upload.command_buffer = renderer->GetCommandBuffers(vk::CommandBufferLevel::ePrimary, 1)[0];
+			pending.upload.command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit), renderer->dldid);
+			recording = true;
+		}
+		// ..a mesh that can't be uploaded is given up on, it doesn't take the frame down with it. It stays mapped until
+		// ..the upload is done either way, a copy out of it may have been recorded before the failure.
+		pending.meshes.push_back(request.mesh);
+		try {
+			pending.buffers.push_back({request.handle, new VertexBuffer(*request.mesh, renderer, &pending.upload)});
+		}
+		catch (...){
+			SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR, "Couldn't upload mesh %s", asset.path.c_str());
+			asset.queued = false;
+			asset.failed = true;
+			continue;
+		}
+		asset.size = request.mesh->header.vertex_size + request.mesh->header.index_size; // ..counted once it's resident
+		uploaded += asset.size;
+	}
+
+	if (recording){
+		pending.upload.command_buffer.end(renderer->dldid);
+		pending.fence = renderer->device->createFence(vk::FenceCreateInfo()).value;
+		auto submit_info = vk::SubmitInfo(0, nullptr, nullptr, 1, &pending.upload.command_buffer);
+		renderer->graphics_queue.submit(submit_info, pending.fence, renderer->dldid);
+		pending.staging_end = pending.upload.staging_offset;
+		if (pending.staging_end != pending.staging_start){
+			staging_head = pending.staging_end;
+		}
+		uploads.push_back(move(pending));
+	}
+
+	Evict();
+}
+
+void AssetStreamer::FinishUploads()
+{
+	// Uploads finish in the order they were submitted, their meshes become resident (and drawable) with them
+	while (!uploads.empty() && renderer->device->getFenceStatus(uploads.front().fence, renderer->dldid) == vk::Result::eSuccess){
+		PendingUpload & finished = uploads.front();
+		for (size_t i = 0; i < finished.buffers.size(); i++){
+			Asset & asset = assets[finished.buffers[i].first];
+			asset.buffer = finished.buffers[i].second;
+			asset.queued = false;
+			asset.last_drawn = renderer->frame_count;
+			residency.push_front(finished.buffers[i].first);
+			asset.lru = residency.begin();
+			resident_bytes += asset.size;
+		}
+		finished.upload.Release();
+		renderer->device->freeCommandBuffers(renderer->command_pool, finished.upload.command_buffer);
+		renderer->device->destroyFence(finished.fence);
+		if (finished.staging_end != finished.staging_start){
+			staging_tail = finished.staging_end;
+		}
+		uploads.pop_front();
+	}
+}
+
+void AssetStreamer::Evict()
+{
+	// Meshes drawn within the last buffer_count frames would only be loaded straight back, so those are kept. The rest
+	// are retired, not deleted: a frame in flight may still draw them.
+	while (resident_bytes > vram_budget && !residency.empty()){
+		Asset & asset = assets[residency.back()];
+		if (asset.last_drawn + renderer->buffer_count > renderer->frame_count){
+			break;
+		}
+		VertexBuffer * evicted = asset.buffer;
+		renderer->Retire([evicted]{ delete evicted; });
+		asset.buffer = nullptr;
+		resident_bytes -= asset.size;
+		residency.pop_back();
+	}
+}
+
+void AssetStreamer::IOThread()
+{
+#ifdef VK_IO_URING
+	struct io_uring ring;
+	bool ring_ready = (io_uring_queue_init(IO_BATCH_SIZE, &ring, 0) == 0);
+#endif
+	while (true){
+		vector<LoadRequest> batch;
+		{
+			unique_lock<mutex> lock(queue_mutex);
+			io_signal.wait(lock, [&]{ return stopping || !io_queue.empty(); });
+			if (stopping){ break; }
+			while (!io_queue.empty() && batch.size() < IO_BATCH_SIZE){
+				batch.push_back(io_queue.top());
+				io_queue.pop();
+			}
+		}
+
+#ifndef _WIN32
+		// Start reading every file in the batch into the page cache at once, the decode workers then map warm pages
+		vector<int> files;
+		for (auto & request : batch){
+			files.push_back(open(request.path.c_str(), O_RDONLY));
+		}
+		bool prefetched = false;
+#ifdef VK_IO_URING
+		if (ring_ready){
+			unsigned submitted = 0;
+			for (int file : files){
+				if (file < 0){ continue; }
+				io_uring_prep_fadvise(io_uring_get_sqe(&ring), file, 0, 0, POSIX_FADV_WILLNEED);
+				submitted++;
+			}
+			io_uring_submit(&ring);
+			for (; submitted > 0; submitted--){
+				struct io_uring_cqe * completion;
+				if (io_uring_wait_cqe(&ring, &completion) == 0){
+					io_uring_cqe_seen(&ring, completion);
+				}
+			}
+			prefetched = true;
+		}
+#endif
+		for (int file : files){
+			if (file < 0){ continue; }
+			if (!prefetched){
+				posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+			}
+			close(file);
+		}
+#endif
+
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			for (auto & request : batch){
+				decode_queue.push(request);
+			}
+		}
+		decode_signal.notify_all();
+	}
+#ifdef VK_IO_URING
+	if (ring_ready){
+		io_uring_queue_exit(&ring);
+	}
+#endif
+}
+
+void AssetStreamer::DecodeThread()
+{
+	while (true){
+		LoadRequest request;
+		{
+			unique_lock<mutex> lock(queue_mutex);
+			decode_signal.wait(lock, [&]{ return stopping || !decode_queue.empty(); });
+			if (stopping){ break; }
+			request = decode_queue.top();
+			decode_queue.pop();
+		}
+
+		try {
+			request.mesh = make_shared<MeshFile>(request.path, false);
+			// ..the streams are copied as they are, so they have to be laid out like Vertex
+			if (request.mesh->header.vertex_stride != sizeof(Vertex)){
+				SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
+					"The vertex layout of %s doesn't match the renderer's Vertex struct, convert it again with mesh_convert", request.path.c_str());
+				throw runtime_error("mesh vertex stride mismatch");
+			}
+			// Touch every page so the upload on the render thread doesn't stall on page faults
+			const volatile uint8_t * bytes = static_cast<const uint8_t *>(request.mesh->Mapping());
+			for (size_t offset = 0; offset < request.mesh->MappingSize(); offset += MESH_STREAM_ALIGNMENT){
+				(void)bytes[offset];
+			}
+		}
+		catch (const exception &){
+			request.mesh = nullptr; // Update() marks the asset as failed
+		}
+
+		lock_guard<mutex> lock(queue_mutex);
+		ready_queue.push(request);
+	}
+}
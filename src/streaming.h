@@ -0,0 +1,107 @@
+#pragma once
+#include "renderer.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <memory>
+
+// Asset Streaming
+// Meshes are loaded in the background in three stages:
+//   I/O thread     - takes requests by priority and starts reading the files into the page cache
+//                    (batched through io_uring when built with VK_IO_URING, posix_fadvise otherwise)
+//   decode workers - map and validate the .vkm file and fault its pages in, so uploading never waits on the disk
+//   Update()       - runs on the render thread, records the copies for a budgeted amount of finished meshes each frame
+//                    (staged through a ring of upload_budget * 2 bytes) and submits them with a fence. A mesh becomes
+//                    resident once a later Update() sees that fence signaled, the queue is never waited on.
+// Resident meshes are kept in a least recently drawn list, and evicted once the geometry in VRAM goes over vram_budget.
+// Evicted buffers are retired through the renderer, so they're freed once no frame in flight draws them.
+typedef uint32_t AssetHandle;
+
+class AssetStreamer {
+	public:
+		uint64_t vram_budget;            // bytes of geometry kept resident before evicting
+		uint64_t upload_budget;          // bytes uploaded per Update(), spreads big loads over several frames
+		uint64_t resident_bytes = 0;
+
+		AssetStreamer(VkRenderer * renderer, uint64_t vram_budget, uint64_t upload_budget = 16 << 20, int decode_threads = 2);
+		~AssetStreamer();
+
+		// ..Queues a mesh to be loaded, higher priorities load first. Requesting a path again returns the same handle.
+		AssetHandle Request(string path, int priority = 0);
+		// ..Returns the mesh and marks it as drawn this frame, or returns nullptr (and queues it again if it was evicted)
+		VertexBuffer * Get(AssetHandle handle);
+		// ..Starts uploading finished loads, makes finished uploads resident, and evicts meshes over the budget.
+		// ..Call once per frame on the render thread, outside of command recording
+		void Update();
+
+	private:
+		struct Asset {
+			string path;
+			int priority;
+			VertexBuffer * buffer = nullptr;  // set once its upload has finished
+			uint64_t size = 0;
+			uint64_t last_drawn = 0;
+			bool queued = false;
+			bool failed = false;
+			list<AssetHandle>::iterator lru;
+		};
+
+		struct LoadRequest {
+			int priority;
+			uint64_t order;
+			AssetHandle handle;
+			string path;
+			shared_ptr<MeshFile> mesh;
+			// priority_queue pops the largest, so: highest priority first, then oldest request first
+			bool operator<(const LoadRequest & other) const {
+				return (priority != other.priority) ? priority < other.priority : order > other.order;
+			}
+		};
+
+		// Copies submitted together, and what they need until their fence signals
+		struct PendingUpload {
+			vk::Fence fence;
+			BufferUpload upload;
+			vector<pair<AssetHandle, VertexBuffer *>> buffers;
+			vector<shared_ptr<MeshFile>> meshes; // ..imported copies read straight out of the mapping (failed ones' too)
+			vk::DeviceSize staging_start = 0, staging_end = 0; // ..the ring space its copies read
+		};
+
+		VkRenderer * renderer;
+		uint64_t request_count = 0;
+
+		// Uploads, owned by the render thread. The ring hands out [staging_head, ...) and gets space back up to
+		// staging_tail as uploads finish, in the order they were submitted.
+		deque<PendingUpload> uploads;
+		vk::Buffer staging_ring = nullptr;
+		vma::Allocation staging_memory = nullptr;
+		uint8_t * staging_data = nullptr;
+		vk::DeviceSize staging_size = 0;
+		vk::DeviceSize staging_head = 0, staging_tail = 0;
+
+		// owned by the render thread
+		vector<Asset> assets;
+		unordered_map<string, AssetHandle> asset_handles;
+		list<AssetHandle> residency;     // front is the most recently drawn
+
+		// shared with the worker threads
+		bool stopping = false;
+		mutex queue_mutex;
+		condition_variable io_signal;
+		condition_variable decode_signal;
+		priority_queue<LoadRequest> io_queue;
+		priority_queue<LoadRequest> decode_queue;
+		priority_queue<LoadRequest> ready_queue;
+		vector<thread> threads;
+
+		void Enqueue(AssetHandle handle);
+		void FinishUploads();
+		void Evict();
+		void IOThread();
+		void DecodeThread();
+};
@@ -0,0 +1,108 @@
+// dispatch_benchmark: measures what a Vulkan call costs through the loader's trampolines, against the same call
+// through the driver's entry point from vkGetDeviceProcAddr (how VkRenderer::dldid dispatches, see src/renderer.h)
+//
+// usage: dispatch_benchmark [calls per run]
+//
+// Records vkCmdSetViewport into a command buffer and polls vkGetFenceStatus, each way, on the first GPU with a
+// graphics queue. Runs alternate between the two and the fastest run of each is reported, so the numbers are
+// the dispatch cost and not whatever else the machine was doing.
+#define VULKAN_HPP_NO_EXCEPTIONS
+#define VULKAN_HPP_ASSERT_ON_RESULT
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+static const int RUNS = 8;
+
+template <typename Dispatch>
+static double RecordViewports(vk::Device device, vk::CommandPool pool, vk::CommandBuffer command_buffer, long calls, const Dispatch & d){
+	device.resetCommandPool(pool, vk::CommandPoolResetFlags());
+	command_buffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit), d);
+	vk::Viewport viewport(0, 0, 640, 480, 0, 1);
+	auto start = chrono::steady_clock::now();
+	for (long i = 0; i < calls; i++){
+		viewport.x = float(i & 1);
+		command_buffer.setViewport(0, 1, &viewport, d);
+	}
+	auto end = chrono::steady_clock::now();
+	command_buffer.end(d);
+	return chrono::duration<double, nano>(end - start).count() / calls;
+}
+
+template <typename Dispatch>
+static double PollFence(vk::Device device, vk::Fence fence, long calls, const Dispatch & d){
+	long signaled = 0;
+	auto start = chrono::steady_clock::now();
+	for (long i = 0; i < calls; i++){
+		signaled += device.getFenceStatus(fence, d) == vk::Result::eSuccess;
+	}
+	auto end = chrono::steady_clock::now();
+	if (signaled != calls){ fprintf(stderr, "dispatch_benchmark: fence wasn't signaled\n"); }
+	return chrono::duration<double, nano>(end - start).count() / calls;
+}
+
+int main(int argc, char ** argv){
+	long calls = (argc > 1) ? atol(argv[1]) : 1000000;
+	if (calls <= 0){
+		fprintf(stderr, "usage: %s [calls per run]\n", argv[0]);
+		return 1;
+	}
+
+	auto app_info = vk::ApplicationInfo("dispatch_benchmark", 1, "Hello Vulkan++", 1, VK_API_VERSION_1_0);
+	vk::Instance instance = vk::createInstance(vk::InstanceCreateInfo(vk::InstanceCreateFlags(), &app_info)).value;
+	if (!instance){
+		fprintf(stderr, "dispatch_benchmark: couldn't create a Vulkan instance\n");
+		return 1;
+	}
+
+	vk::PhysicalDevice gpu;
+	uint32_t family = 0;
+	for (auto physical_device : instance.enumeratePhysicalDevices().value){
+		auto families = physical_device.getQueueFamilyProperties();
+		for (uint32_t i = 0; i < families.size() && !gpu; i++){
+			if (families[i].queueFlags & vk::QueueFlagBits::eGraphics){
+				gpu = physical_device;
+				family = i;
+			}
+		}
+	}
+	if (!gpu){
+		fprintf(stderr, "dispatch_benchmark: no GPU with a graphics queue\n");
+		instance.destroy();
+		return 1;
+	}
+
+	float priority = 1.0f;
+	auto queue_info = vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags(), family, 1, &priority);
+	vk::Device device = gpu.createDevice(vk::DeviceCreateInfo(vk::DeviceCreateFlags(), 1, &queue_info)).value;
+	vk::CommandPool pool = device.createCommandPool(vk::CommandPoolCreateInfo(vk::CommandPoolCreateFlags(), family)).value;
+	vk::CommandBuffer command_buffer = device.allocateCommandBuffers(vk::CommandBufferAllocateInfo(pool, vk::CommandBufferLevel::ePrimary, 1)).value[0];
+	vk::Fence fence = device.createFence(vk::FenceCreateInfo(vk::FenceCreateFlagBits::eSignaled)).value;
+
+	vk::DispatchLoaderStatic loader;
+	vk::DispatchLoaderDynamic direct(instance, vkGetInstanceProcAddr, device, vkGetDeviceProcAddr);
+
+	double record[2] = {1e9, 1e9}, poll[2] = {1e9, 1e9};
+	for (int run = 0; run < RUNS; run++){
+		record[0] = min(record[0], RecordViewports(device, pool, command_buffer, calls, loader));
+		record[1] = min(record[1], RecordViewports(device, pool, command_buffer, calls, direct));
+		poll[0] = min(poll[0], PollFence(device, fence, calls, loader));
+		poll[1] = min(poll[1], PollFence(device, fence, calls, direct));
+	}
+
+	printf("%s, %ld calls per run, best of %d\n", gpu.getProperties().deviceName.data(), calls, RUNS);
+	printf("%-20s %10s %10s %10s\n", "", "loader", "direct", "saved");
+	printf("%-20s %8.2fns %8.2fns %8.2fns\n", "vkCmdSetViewport", record[0], record[1], record[0] - record[1]);
+	printf("%-20s %8.2fns %8.2fns %8.2fns\n", "vkGetFenceStatus", poll[0], poll[1], poll[0] - poll[1]);
+
+	device.destroyFence(fence);
+	device.destroyCommandPool(pool);
+	device.destroy();
+	instance.destroy();
+	return 0;
+}
@@ -0,0 +1,217 @@
+// mesh_convert: converts interchange mesh formats into the engine's binary .vkm container (see src/mesh.h)
+//
+// usage: mesh_convert <input.obj|input.ply> <output.vkm>
+//
+// Supported inputs:
+//   .obj - positions and faces; per vertex colors are read from the common "v x y z r g b" extension.
+//   .ply - ASCII PLY with x/y/z and optional red/green/blue vertex properties (float or uchar) and a face list.
+// Faces with more than three corners are fan triangulated. Only x and y are kept, to match Vertex in renderer.h.
+#include "../src/mesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// Must match the layout of Vertex (glm::vec2 pos, glm::vec3 color) in renderer.h
+struct PackedVertex {
+	float pos[2];
+	float color[3];
+};
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex has to match the renderer's Vertex layout");
+
+struct Mesh {
+	vector<PackedVertex> vertices;
+	vector<uint32_t> indices;
+};
+
+static bool Fail(string message){
+	fprintf(stderr, "mesh_convert: %s\n", message.c_str());
+	return false;
+}
+
+static void AddPolygon(Mesh & mesh, const vector<uint32_t> & corners){
+	for (size_t i = 2; i < corners.size(); i++){
+		mesh.indices.push_back(corners[0]);
+		mesh.indices.push_back(corners[i - 1]);
+		mesh.indices.push_back(corners[i]);
+	}
+}
+
+static bool ReadObj(string filename, Mesh & mesh){
+	ifstream file(filename);
+	if (!file.is_open()){ return Fail("can't open " + filename); }
+
+	string line;
+	while (getline(file, line)){
+		istringstream stream(line);
+		string type;
+		stream >> type;
+		if (type == "v"){
+			float x = 0, y = 0, z = 0;
+			PackedVertex vertex = {{0, 0}, {1, 1, 1}};
+			stream >> x >> y >> z;
+			vertex.pos[0] = x;
+			vertex.pos[1] = y;
+			float r, g, b;
+			if (stream >> r >> g >> b){
+				vertex.color[0] = r;
+				vertex.color[1] = g;
+				vertex.color[2] = b;
+			}
+			mesh.vertices.push_back(vertex);
+		}
+		else if (type == "f"){
+			vector<uint32_t> corners;
+			string corner;
+			while (stream >> corner){
+				// "v", "v/vt", "v//vn" and "v/vt/vn" all start with the position index
+				long index = strtol(corner.c_str(), nullptr, 10);
+				if (index < 0){ index += long(mesh.vertices.size()) + 1; }
+				if (index < 1 || index > long(mesh.vertices.size())){
+					return Fail("face refers to a vertex that doesn't exist: " + line);
+				}
+				corners.push_back(uint32_t(index - 1));
+			}
+			AddPolygon(mesh, corners);
+		}
+	}
+	return true;
+}
+
+static bool ReadPly(string filename, Mesh & mesh){
+	ifstream file(filename);
+	if (!file.is_open()){ return Fail("can't open " + filename); }
+
+	string line;
+	getline(file, line);
+	if (line.rfind("ply", 0) != 0){ return Fail(filename + " isn't a PLY file"); }
+
+	size_t vertex_count = 0, face_count = 0;
+	vector<string> vertex_properties, vertex_types;
+	string current_element;
+	while (getline(file, line)){
+		istringstream stream(line);
+		string keyword;
+		stream >> keyword;
+		if (keyword == "format"){
+			string format;
+			stream >> format;
+			if (format != "ascii"){ return Fail("only ASCII PLY files are supported"); }
+		}
+		else if (keyword == "element"){
+			size_t count = 0;
+			stream >> current_element >> count;
+			if (current_element == "vertex"){ vertex_count = count; }
+			if (current_element == "face"){ face_count = count; }
+		}
+		else if (keyword == "property" && current_element == "vertex"){
+			string type, name;
+			stream >> type >> name;
+			vertex_types.push_back(type);
+			vertex_properties.push_back(name);
+		}
+		else if (keyword == "end_header"){
+			break;
+		}
+	}
+
+	auto find_property = [&](string name){
+		return int(find(vertex_properties.begin(), vertex_properties.end(), name) - vertex_properties.begin());
+	};
+	int x = find_property("x"), y = find_property("y");
+	int color[3] = {find_property("red"), find_property("green"), find_property("blue")};
+	if (x == int(vertex_properties.size()) || y == int(vertex_properties.size())){
+		return Fail("PLY vertices have no x/y properties");
+	}
+
+	vector<float> values(vertex_properties.size());
+	for (size_t v = 0; v < vertex_count; v++){
+		for (auto & value : values){ file >> value; }
+		PackedVertex vertex = {{values[x], values[y]}, {1, 1, 1}};
+		for (int c = 0; c < 3; c++){
+			if (color[c] < int(values.size())){
+				float scale = (vertex_types[color[c]] == "uchar" || vertex_types[color[c]] == "uint8") ? 1.0f / 255.0f : 1.0f;
+				vertex.color[c] = values[color[c]] * scale;
+			}
+		}
+		mesh.vertices.push_back(vertex);
+	}
+
+	for (size_t f = 0; f < face_count; f++){
+		size_t corner_count = 0;
+		file >> corner_count;
+		vector<uint32_t> corners(corner_count);
+		for (auto & corner : corners){
+			file >> corner;
+			if (corner >= mesh.vertices.size()){ return Fail("face refers to a vertex that doesn't exist"); }
+		}
+		AddPolygon(mesh, corners);
+	}
+	if (!file){ return Fail(filename + " is truncated"); }
+	return true;
+}
+
+static uint64_t AlignUp(uint64_t value){
+	return (value + MESH_STREAM_ALIGNMENT - 1) & ~uint64_t(MESH_STREAM_ALIGNMENT - 1);
+}
+
+static bool WriteMesh(string filename, const Mesh & mesh){
+	bool wide_indices = mesh.vertices.size() > 0xFFFF;
+	MeshFileHeader header = {};
+	header.magic = MESH_FILE_MAGIC;
+	header.version = MESH_FILE_VERSION;
+	header.vertex_stride = sizeof(PackedVertex);
+	header.vertex_count = uint32_t(mesh.vertices.size());
+	header.index_type = mesh.indices.empty() ? MESH_INDEX_NONE : (wide_indices ? MESH_INDEX_UINT32 : MESH_INDEX_UINT16);
+	header.index_count = uint32_t(mesh.indices.size());
+	header.vertex_offset = AlignUp(sizeof(MeshFileHeader));
+	header.vertex_size = sizeof(PackedVertex) * mesh.vertices.size();
+	header.index_offset = AlignUp(header.vertex_offset + header.vertex_size);
+	header.index_size = mesh.indices.size() * (wide_indices ? 4 : 2);
+
+	// The file is padded to a whole number of blocks so that any stream, rounded up to the alignment,
+	// still lies inside the file (needed to map or import it on its own).
+	vector<uint8_t> contents(AlignUp(header.index_offset + header.index_size));
+	memcpy(contents.data(), &header, sizeof(header));
+	memcpy(contents.data() + header.vertex_offset, mesh.vertices.data(), header.vertex_size);
+	if (wide_indices){
+		memcpy(contents.data() + header.index_offset, mesh.indices.data(), header.index_size);
+	}
+	else {
+		uint16_t * indices = reinterpret_cast<uint16_t *>(contents.data() + header.index_offset);
+		for (size_t i = 0; i < mesh.indices.size(); i++){ indices[i] = uint16_t(mesh.indices[i]); }
+	}
+
+	ofstream file(filename, ios::binary);
+	if (!file.is_open()){ return Fail("can't write " + filename); }
+	file.write(reinterpret_cast<const char *>(contents.data()), contents.size());
+	return bool(file);
+}
+
+int main(int argc, char ** argv){
+	if (argc != 3){
+		fprintf(stderr, "usage: %s <input.obj|input.ply> <output.vkm>\n", argv[0]);
+		return 1;
+	}
+	string input = argv[1];
+	string extension = input.substr(input.find_last_of('.') + 1);
+	transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	Mesh mesh;
+	bool read = false;
+	if (extension == "obj"){ read = ReadObj(input, mesh); }
+	else if (extension == "ply"){ read = ReadPly(input, mesh); }
+	else { Fail("unknown input format ." + extension); }
+	if (!read || !WriteMesh(argv[2], mesh)){
+		return 1;
+	}
+
+	printf("%s: %zu vertices, %zu indices\n", argv[2], mesh.vertices.size(), mesh.indices.size());
+	return 0;
+}
@@ -0,0 +1,129 @@
+// shader_pack: packs compiled SPIR-V into the engine's shader archive (see src/shader_archive.h)
+//
+// usage: shader_pack <output.pak> <shader.spv | id=shader.spv> ...
+//
+// A shader is found at runtime by the path LoadShaderModule is given, which is the file's own path unless an
+// id is given (so GLSL compiled by the build can be packed under the .vert/.frag path the engine asks for).
+#include "../src/shader_archive.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct PackedShader {
+	string id;
+	vector<char> code;
+	uint64_t hash = 0;
+};
+
+static bool Fail(string message){
+	fprintf(stderr, "shader_pack: %s\n", message.c_str());
+	return false;
+}
+
+static bool ReadShader(string argument, PackedShader & shader){
+	size_t separator = argument.find('=');
+	string file = (separator == string::npos) ? argument : argument.substr(separator + 1);
+	shader.id = (separator == string::npos) ? argument : argument.substr(0, separator);
+
+	ifstream input(file, ios::ate | ios::binary);
+	if (!input.is_open()){ return Fail("can't open " + file); }
+	shader.code.resize(size_t(input.tellg()));
+	input.seekg(0, ios::beg);
+	input.read(shader.code.data(), shader.code.size());
+	uint32_t magic = 0;
+	if (shader.code.size() >= 4){ memcpy(&magic, shader.code.data(), 4); }
+	if (magic != 0x07230203 || shader.code.size() % 4){ return Fail(file + " isn't SPIR-V"); }
+	return true;
+}
+
+// Tries seeds until every id hashes to its own slot, growing the table when a size takes too many tries
+static void PickSeed(vector<PackedShader> & shaders, uint32_t & seed, uint32_t & slot_count){
+	slot_count = 1;
+	while (slot_count < shaders.size() * 2){ slot_count *= 2; }
+	for (;;){
+		for (seed = 0; seed < 4096; seed++){
+			vector<bool> used(slot_count, false);
+			bool collision = false;
+			for (auto & shader : shaders){
+				shader.hash = ShaderArchiveHash(shader.id.data(), shader.id.size(), seed);
+				uint32_t slot = uint32_t(shader.hash & (slot_count - 1));
+				if (used[slot]){ collision = true; break; }
+				used[slot] = true;
+			}
+			if (!collision){ return; }
+		}
+		slot_count *= 2;
+	}
+}
+
+static size_t Align(size_t offset){
+	return (offset + SHADER_ARCHIVE_ALIGNMENT - 1) / SHADER_ARCHIVE_ALIGNMENT * SHADER_ARCHIVE_ALIGNMENT;
+}
+
+static bool WriteArchive(string filename, vector<PackedShader> & shaders){
+	ShaderArchiveHeader header = {SHADER_ARCHIVE_MAGIC, SHADER_ARCHIVE_VERSION, 0, 0};
+	PickSeed(shaders, header.seed, header.slot_count);
+
+	vector<ShaderArchiveSlot> slots(header.slot_count, ShaderArchiveSlot{0, 0, 0, 0, 0});
+	size_t offset = sizeof(header) + slots.size() * sizeof(ShaderArchiveSlot);
+	for (auto & shader : shaders){
+		auto & slot = slots[shader.hash & (header.slot_count - 1)];
+		slot.id_hash = shader.hash;
+		slot.id_offset = uint32_t(offset);
+		slot.id_size = uint32_t(shader.id.size());
+		offset += shader.id.size();
+	}
+	for (auto & shader : shaders){
+		auto & slot = slots[shader.hash & (header.slot_count - 1)];
+		offset = Align(offset);
+		slot.code_offset = uint32_t(offset);
+		slot.code_size = uint32_t(shader.code.size());
+		offset += shader.code.size();
+	}
+	if (offset > UINT32_MAX){ return Fail("archive would be larger than 4GB"); }
+
+	ofstream output(filename, ios::binary);
+	if (!output.is_open()){ return Fail("can't write " + filename); }
+	output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+	output.write(reinterpret_cast<const char *>(slots.data()), slots.size() * sizeof(ShaderArchiveSlot));
+	offset = sizeof(header) + slots.size() * sizeof(ShaderArchiveSlot);
+	for (auto & shader : shaders){
+		output.write(shader.id.data(), shader.id.size());
+		offset += shader.id.size();
+	}
+	for (auto & shader : shaders){
+		static const char padding[SHADER_ARCHIVE_ALIGNMENT] = {};
+		output.write(padding, Align(offset) - offset);
+		output.write(shader.code.data(), shader.code.size());
+		offset = Align(offset) + shader.code.size();
+	}
+	return output.good();
+}
+
+int main(int argc, char ** argv){
+	if (argc < 3){
+		fprintf(stderr, "usage: %s <output.pak> <shader.spv | id=shader.spv> ...\n", argv[0]);
+		return 1;
+	}
+	vector<PackedShader> shaders(argc - 2);
+	for (int i = 2; i < argc; i++){
+		if (!ReadShader(argv[i], shaders[i - 2])){ return 1; }
+		for (int j = 2; j < i; j++){
+			if (shaders[j - 2].id == shaders[i - 2].id){
+				Fail("shader id " + shaders[i - 2].id + " given twice");
+				return 1;
+			}
+		}
+	}
+	if (!WriteArchive(argv[1], shaders)){
+		return 1;
+	}
+
+	printf("%s: %zu shaders\n", argv[1], shaders.size());
+	return 0;
+}